@@ -0,0 +1,1688 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <gtk/gtk.h>
+#include <pango/pangocairo.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "tecla-application-private.h"
+#include "tecla-key-popover.h"
+#include "tecla-keymap-cache.h"
+#include "tecla-keymap-observer.h"
+#include "tecla-label.h"
+#include "tecla-label-table.h"
+#include "tecla-model.h"
+#include "tecla-text-cache-private.h"
+#include "tecla-util.h"
+#include "tecla-view-private.h"
+
+#ifdef HAVE_XKBREGISTRY
+#include <xkbcommon/xkbregistry.h>
+#endif
+
+#ifdef HAVE_TEST_COMPOSITOR
+#include <wayland-client.h>
+
+#include "tecla-test-compositor.h"
+#endif
+
+typedef struct
+{
+	const gchar *name;
+	gboolean (*run) (void);
+} BenchCase;
+
+static int n_jobs = 1;
+static gboolean use_keymap_cache = FALSE;
+
+static double
+ns_per_op (gint64 elapsed_us,
+	   gsize  n_ops)
+{
+	return (double) elapsed_us * 1000.0 / n_ops;
+}
+
+#ifdef HAVE_LIBC_MALLOC
+/* Count the allocations made by each thread, by wrapping the libc
+ * allocator. Only the measured thread's figure is reported. Aligned
+ * allocations are counted too, GLib and graphene make those. Memory
+ * mapped directly, or through valloc() and pvalloc(), is not.
+ */
+extern void * __libc_malloc (size_t size);
+extern void * __libc_calloc (size_t n_members, size_t size);
+extern void * __libc_realloc (void *ptr, size_t size);
+extern void * __libc_memalign (size_t alignment, size_t size);
+
+static __thread gsize n_allocs;
+
+void *
+malloc (size_t size)
+{
+	n_allocs++;
+	return __libc_malloc (size);
+}
+
+void *
+calloc (size_t n_members,
+	size_t size)
+{
+	n_allocs++;
+	return __libc_calloc (n_members, size);
+}
+
+void *
+realloc (void   *ptr,
+	 size_t  size)
+{
+	n_allocs++;
+	return __libc_realloc (ptr, size);
+}
+
+void *
+memalign (size_t alignment,
+	  size_t size)
+{
+	n_allocs++;
+	return __libc_memalign (alignment, size);
+}
+
+void *
+aligned_alloc (size_t alignment,
+	       size_t size)
+{
+	n_allocs++;
+	return __libc_memalign (alignment, size);
+}
+
+int
+posix_memalign (void   **ptr,
+		size_t   alignment,
+		size_t   size)
+{
+	void *mem;
+
+	if (alignment % sizeof (void *) != 0 ||
+	    (alignment & (alignment - 1)) != 0)
+		return EINVAL;
+
+	n_allocs++;
+	mem = __libc_memalign (alignment, size);
+	if (!mem)
+		return ENOMEM;
+
+	*ptr = mem;
+
+	return 0;
+}
+#endif
+
+static gsize
+get_n_allocs (void)
+{
+#ifdef HAVE_LIBC_MALLOC
+	return n_allocs;
+#else
+	return 0;
+#endif
+}
+
+typedef void (*MicroFunc) (gpointer data,
+			   gsize    op);
+
+static int
+compare_doubles (gconstpointer a,
+		 gconstpointer b)
+{
+	double da = *(const double *) a, db = *(const double *) b;
+
+	return (da > db) - (da < db);
+}
+
+static const gchar *
+format_double (gchar  *buf,
+	       double  value)
+{
+	/* JSON wants a dot whatever the locale */
+	return g_ascii_formatd (buf, G_ASCII_DTOSTR_BUF_SIZE, "%.1f", value);
+}
+
+static void
+append_number (GString     *line,
+	       const gchar *key,
+	       double       value)
+{
+	gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+	g_string_append_printf (line, ", \"%s\": %s", key, format_double (buf, value));
+}
+
+/* Prints the JSON line every case reports with: ns/op over @n_ops
+ * operations taking @elapsed_us, allocations/op, and percentiles of
+ * the ns/op in @samples, which get sorted. @extra members, if any,
+ * are appended as they are.
+ */
+static void
+print_result (const gchar *name,
+	      gsize        n_ops,
+	      gint64       elapsed_us,
+	      gsize        n_allocs,
+	      double      *samples,
+	      gsize        n_samples,
+	      const gchar *extra)
+{
+	g_autoptr (GString) line = NULL;
+	gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+	line = g_string_new (NULL);
+	g_string_append_printf (line, "{\"name\": \"%s\", \"ops\": %" G_GSIZE_FORMAT,
+				name, n_ops);
+	append_number (line, "ns_per_op", ns_per_op (elapsed_us, MAX (n_ops, 1)));
+
+#ifdef HAVE_LIBC_MALLOC
+	g_string_append_printf (line, ", \"allocs_per_op\": %s",
+				g_ascii_formatd (buf, sizeof (buf), "%.2f",
+						 (double) n_allocs / MAX (n_ops, 1)));
+#else
+	(void) buf;
+	g_string_append (line, ", \"allocs_per_op\": null");
+#endif
+
+	if (n_samples > 0) {
+		qsort (samples, n_samples, sizeof (double), compare_doubles);
+		append_number (line, "p50", samples[n_samples / 2]);
+		append_number (line, "p90", samples[(n_samples * 90) / 100]);
+		append_number (line, "p99", samples[(n_samples * 99) / 100]);
+		append_number (line, "max", samples[n_samples - 1]);
+	} else {
+		g_string_append (line, ", \"p50\": null, \"p90\": null, "
+				 "\"p99\": null, \"max\": null");
+	}
+
+	if (extra)
+		g_string_append_printf (line, ", %s", extra);
+
+	g_print ("%s}\n", line->str);
+}
+
+static void
+print_skipped (const gchar *name,
+	       const gchar *reason)
+{
+	g_print ("{\"name\": \"%s\", \"skipped\": \"%s\"}\n", name, reason);
+}
+
+/* Runs @func over batches of @n_ops operations and reports ns/op,
+ * allocations/op and percentiles of the per-batch ns/op.
+ */
+static void
+measure_micro (const gchar *name,
+	       MicroFunc    func,
+	       gpointer     data,
+	       gsize        n_ops,
+	       int          n_batches)
+{
+	g_autofree double *samples = NULL;
+	gint64 start, elapsed_us, total_us = 0;
+	gsize op, allocs_start;
+	int batch;
+
+	samples = g_new (double, n_batches);
+
+	/* Warm up caches and lazily created state */
+	for (op = 0; op < n_ops; op++)
+		func (data, op);
+
+	allocs_start = get_n_allocs ();
+
+	for (batch = 0; batch < n_batches; batch++) {
+		start = g_get_monotonic_time ();
+		for (op = 0; op < n_ops; op++)
+			func (data, batch * n_ops + op);
+		elapsed_us = g_get_monotonic_time () - start;
+
+		samples[batch] = ns_per_op (elapsed_us, n_ops);
+		total_us += elapsed_us;
+	}
+
+	print_result (name, n_ops * n_batches, total_us,
+		      get_n_allocs () - allocs_start,
+		      samples, n_batches, NULL);
+}
+
+static gboolean
+bench_labels (void)
+{
+	const int n_compute_rounds = 20, n_table_rounds = 1000;
+	const gchar * volatile sink;
+	g_autofree double *samples = NULL;
+	g_autofree gchar *extra = NULL;
+	gint64 start, round_start, compute_us, table_us;
+	gsize i, n_mismatches = 0, allocs_start, compute_allocs, table_allocs;
+	int round;
+
+	for (i = 0; i < tecla_label_n_keysyms; i++) {
+		xkb_keysym_t keysym = tecla_label_keysyms[i];
+		g_autofree gchar *label = tecla_label_compute (keysym);
+
+		if (g_strcmp0 (label, tecla_label_table_lookup (keysym)) != 0) {
+			g_printerr ("labels: mismatch for keysym 0x%x\n", keysym);
+			n_mismatches++;
+		}
+	}
+
+	extra = g_strdup_printf ("\"keysyms\": %" G_GSIZE_FORMAT ", "
+				 "\"mismatches\": %" G_GSIZE_FORMAT,
+				 tecla_label_n_keysyms, n_mismatches);
+	samples = g_new (double, MAX (n_compute_rounds, n_table_rounds));
+
+	allocs_start = get_n_allocs ();
+	start = g_get_monotonic_time ();
+	for (round = 0; round < n_compute_rounds; round++) {
+		round_start = g_get_monotonic_time ();
+		for (i = 0; i < tecla_label_n_keysyms; i++)
+			g_free (tecla_label_compute (tecla_label_keysyms[i]));
+		samples[round] = ns_per_op (g_get_monotonic_time () - round_start,
+					    tecla_label_n_keysyms);
+	}
+	compute_us = g_get_monotonic_time () - start;
+	compute_allocs = get_n_allocs () - allocs_start;
+
+	print_result ("labels-compute", n_compute_rounds * tecla_label_n_keysyms,
+		      compute_us, compute_allocs, samples, n_compute_rounds, extra);
+
+	allocs_start = get_n_allocs ();
+	start = g_get_monotonic_time ();
+	for (round = 0; round < n_table_rounds; round++) {
+		round_start = g_get_monotonic_time ();
+		for (i = 0; i < tecla_label_n_keysyms; i++)
+			sink = tecla_label_table_lookup (tecla_label_keysyms[i]);
+		samples[round] = ns_per_op (g_get_monotonic_time () - round_start,
+					    tecla_label_n_keysyms);
+	}
+	table_us = g_get_monotonic_time () - start;
+	table_allocs = get_n_allocs () - allocs_start;
+	(void) sink;
+
+	print_result ("labels-table", n_table_rounds * tecla_label_n_keysyms,
+		      table_us, table_allocs, samples, n_table_rounds, extra);
+
+	return n_mismatches == 0;
+}
+
+static gboolean
+bench_key_events (void)
+{
+	/* Mostly letters, with a Shift press/release every few keys */
+	const gchar *stream_keys[] = {
+		"AC01", "AC02", "AC03", "LFSH", "AD01", "LFSH", "AD02", "AD03",
+		"AB01", "AB02", "SPCE", "AE01", "AE02", "RTSH", "AC04", "RTSH",
+	};
+	const int n_events = 100000, batch_size = 1000;
+	g_autoptr (TeclaModel) model = NULL;
+	g_autofree double *samples = NULL;
+	xkb_keycode_t stream[G_N_ELEMENTS (stream_keys)];
+	GtkWidget *view;
+	gint64 start, batch_start, elapsed_us;
+	gsize i, allocs_start;
+	int event;
+
+	if (!gtk_init_check ()) {
+		print_skipped ("key-events", "no display");
+		return TRUE;
+	}
+
+	model = tecla_model_new_from_layout_name ("us");
+	if (!model) {
+		g_printerr ("key-events: could not compile the “us” layout\n");
+		return FALSE;
+	}
+
+	view = g_object_ref_sink (tecla_view_new ());
+	tecla_view_set_model (TECLA_VIEW (view), model);
+
+	for (i = 0; i < G_N_ELEMENTS (stream_keys); i++)
+		stream[i] = tecla_model_get_key_keycode (model, stream_keys[i]);
+
+	samples = g_new (double, n_events / batch_size);
+	allocs_start = get_n_allocs ();
+	start = batch_start = g_get_monotonic_time ();
+	for (event = 0; event < n_events; event++) {
+		xkb_keycode_t keycode = stream[event % G_N_ELEMENTS (stream)];
+
+		tecla_view_handle_key_event (TECLA_VIEW (view), keycode, TRUE);
+		tecla_view_handle_key_event (TECLA_VIEW (view), keycode, FALSE);
+
+		if ((event + 1) % batch_size == 0) {
+			gint64 now = g_get_monotonic_time ();
+
+			samples[event / batch_size] = ns_per_op (now - batch_start,
+								 batch_size * 2);
+			batch_start = now;
+		}
+	}
+	elapsed_us = g_get_monotonic_time () - start;
+
+	print_result ("key-events", n_events * 2, elapsed_us,
+		      get_n_allocs () - allocs_start,
+		      samples, n_events / batch_size, NULL);
+
+	g_object_unref (view);
+
+	return TRUE;
+}
+
+static gsize
+get_rss_kb (void)
+{
+	unsigned long size, resident = 0;
+	FILE *file;
+
+	file = fopen ("/proc/self/statm", "r");
+	if (!file)
+		return 0;
+
+	if (fscanf (file, "%lu %lu", &size, &resident) != 2)
+		resident = 0;
+
+	fclose (file);
+
+	return resident * sysconf (_SC_PAGESIZE) / 1024;
+}
+
+static guint
+count_widgets (GtkWidget *widget)
+{
+	GtkWidget *child;
+	guint n_widgets = 1;
+
+	for (child = gtk_widget_get_first_child (widget);
+	     child;
+	     child = gtk_widget_get_next_sibling (child))
+		n_widgets += count_widgets (child);
+
+	return n_widgets;
+}
+
+static GtkWidget *
+present_view (GtkWidget *view)
+{
+	GtkWidget *window;
+	gint64 deadline;
+
+	window = gtk_window_new ();
+	gtk_window_set_default_size (GTK_WINDOW (window), 1000, 350);
+	gtk_window_set_child (GTK_WINDOW (window), view);
+	gtk_window_present (GTK_WINDOW (window));
+
+	/* Let the first frame go through */
+	deadline = g_get_monotonic_time () + 5 * G_USEC_PER_SEC;
+	while (!gtk_widget_get_mapped (view) || gtk_widget_get_width (view) == 0) {
+		if (g_get_monotonic_time () > deadline) {
+			gtk_window_destroy (GTK_WINDOW (window));
+			return NULL;
+		}
+
+		g_main_context_iteration (NULL, TRUE);
+	}
+
+	while (g_main_context_iteration (NULL, FALSE));
+
+	return window;
+}
+
+static gboolean
+measure_render (TeclaModel *model,
+		gboolean    single_widget,
+		gboolean    report)
+{
+	const int n_frames = 500;
+	const gchar *mode = single_widget ? "single-widget" : "widget-per-key";
+	g_autoptr (GdkPaintable) paintable = NULL;
+	g_autofree double *samples = NULL;
+	GdkFrameClock *frame_clock;
+	GtkWidget *window, *view;
+	gsize rss_before, rss_after, allocs_start;
+	gint64 start, frame_start, elapsed_us;
+	int frame, width, height;
+
+	rss_before = get_rss_kb ();
+
+	view = g_object_new (TECLA_TYPE_VIEW,
+			     "single-widget", single_widget,
+			     NULL);
+	tecla_view_set_model (TECLA_VIEW (view), model);
+
+	window = present_view (view);
+	if (!window) {
+		g_printerr ("render: %s view was never mapped\n", mode);
+		return FALSE;
+	}
+
+	rss_after = get_rss_kb ();
+	width = gtk_widget_get_width (view);
+	height = gtk_widget_get_height (view);
+	paintable = gtk_widget_paintable_new (view);
+	frame_clock = gtk_widget_get_frame_clock (view);
+
+	samples = g_new (double, n_frames);
+
+	/* Each frame relabels the keys for a level switch and redraws */
+	allocs_start = get_n_allocs ();
+	start = g_get_monotonic_time ();
+	for (frame = 0; frame < n_frames; frame++) {
+		GtkSnapshot *snapshot;
+		GskRenderNode *node;
+
+		frame_start = g_get_monotonic_time ();
+		tecla_view_set_current_level (TECLA_VIEW (view), frame % 2);
+
+		/* Relabeling happens in the update phase, run it without
+		 * waiting for the next vblank.
+		 */
+		g_signal_emit_by_name (frame_clock, "update");
+
+		snapshot = gtk_snapshot_new ();
+		gdk_paintable_snapshot (paintable, snapshot, width, height);
+		node = gtk_snapshot_free_to_node (snapshot);
+		g_clear_pointer (&node, gsk_render_node_unref);
+
+		samples[frame] = ns_per_op (g_get_monotonic_time () - frame_start, 1);
+	}
+	elapsed_us = g_get_monotonic_time () - start;
+
+	if (report) {
+		g_autofree gchar *name = NULL, *extra = NULL;
+
+		name = g_strdup_printf ("render-%s", mode);
+		extra = g_strdup_printf ("\"widgets\": %u, \"rss_kib\": %" G_GSIZE_FORMAT,
+					 count_widgets (view),
+					 rss_after > rss_before ? rss_after - rss_before : 0);
+		print_result (name, n_frames, elapsed_us,
+			      get_n_allocs () - allocs_start,
+			      samples, n_frames, extra);
+	}
+
+	gtk_window_destroy (GTK_WINDOW (window));
+
+	return TRUE;
+}
+
+static gboolean
+bench_render (void)
+{
+	g_autoptr (TeclaModel) model = NULL;
+	gboolean success = TRUE;
+
+	if (!gtk_init_check ()) {
+		print_skipped ("render", "no display");
+		return TRUE;
+	}
+
+	model = tecla_model_new_from_layout_name ("us");
+	if (!model) {
+		g_printerr ("render: could not compile the “us” layout\n");
+		return FALSE;
+	}
+
+	/* Warm up, so one-time theme and font loading is not accounted */
+	if (!measure_render (model, FALSE, FALSE))
+		return FALSE;
+
+	if (!measure_render (model, TRUE, TRUE))
+		success = FALSE;
+	if (!measure_render (model, FALSE, TRUE))
+		success = FALSE;
+
+	return success;
+}
+
+static gboolean
+bench_text_cache (void)
+{
+	g_autoptr (TeclaModel) model = NULL;
+	GtkWidget *windows[2];
+	guint hits, misses, last_hits = 0, last_misses = 0;
+	gsize n_bytes, allocs_start;
+	gint64 start, elapsed_us;
+	int i;
+
+	if (!gtk_init_check ()) {
+		print_skipped ("text-cache", "no display");
+		return TRUE;
+	}
+
+	model = tecla_model_new_from_layout_name ("us");
+	if (!model) {
+		g_printerr ("text-cache: could not compile the “us” layout\n");
+		return FALSE;
+	}
+
+	/* One op is a window presented, the second one should hit */
+	for (i = 0; i < (int) G_N_ELEMENTS (windows); i++) {
+		GtkWidget *view = tecla_view_new ();
+		g_autofree gchar *name = NULL, *extra = NULL;
+		double sample;
+
+		allocs_start = get_n_allocs ();
+		start = g_get_monotonic_time ();
+		tecla_view_set_model (TECLA_VIEW (view), model);
+		windows[i] = present_view (view);
+		if (!windows[i]) {
+			g_printerr ("text-cache: view was never mapped\n");
+			return FALSE;
+		}
+		elapsed_us = g_get_monotonic_time () - start;
+		sample = ns_per_op (elapsed_us, 1);
+
+		tecla_text_cache_get_stats (&hits, &misses, &n_bytes);
+		name = g_strdup_printf ("text-cache-window-%d", i + 1);
+		extra = g_strdup_printf ("\"hits\": %u, \"misses\": %u, "
+					 "\"bytes\": %" G_GSIZE_FORMAT,
+					 hits - last_hits, misses - last_misses,
+					 n_bytes);
+		print_result (name, 1, elapsed_us, get_n_allocs () - allocs_start,
+			      &sample, 1, extra);
+		last_hits = hits;
+		last_misses = misses;
+	}
+
+	for (i = 0; i < (int) G_N_ELEMENTS (windows); i++)
+		gtk_window_destroy (GTK_WINDOW (windows[i]));
+
+	return TRUE;
+}
+
+static void
+after_paint_cb (GdkFrameClock *frame_clock,
+		gboolean      *painted)
+{
+	*painted = TRUE;
+}
+
+/* Time from presenting a view until its first frame is painted, and
+ * until no legends are left to shape in the background.
+ */
+static gboolean
+measure_first_frame (TeclaModel   *model,
+		     PangoFontMap *font_map,
+		     gint64       *elapsed_us,
+		     gint64       *settled_us)
+{
+	GdkFrameClock *frame_clock;
+	GtkWidget *window, *view;
+	gboolean painted = FALSE;
+	gint64 start, deadline;
+	gulong handler_id;
+
+	view = tecla_view_new ();
+	window = gtk_window_new ();
+	gtk_window_set_default_size (GTK_WINDOW (window), 1000, 350);
+	gtk_window_set_child (GTK_WINDOW (window), view);
+
+	/* Fonts are looked up on the view's font map, children included */
+	if (font_map)
+		gtk_widget_set_font_map (view, font_map);
+
+	gtk_widget_realize (window);
+	frame_clock = gtk_widget_get_frame_clock (window);
+	handler_id = g_signal_connect (frame_clock, "after-paint",
+				       G_CALLBACK (after_paint_cb), &painted);
+
+	start = g_get_monotonic_time ();
+	deadline = start + 5 * G_USEC_PER_SEC;
+	tecla_view_set_model (TECLA_VIEW (view), model);
+	gtk_window_present (GTK_WINDOW (window));
+
+	while (!(painted && gtk_widget_get_mapped (view)) &&
+	       g_get_monotonic_time () < deadline)
+		g_main_context_iteration (NULL, TRUE);
+
+	*elapsed_us = g_get_monotonic_time () - start;
+
+	while (tecla_text_cache_get_n_pending () > 0 &&
+	       g_get_monotonic_time () < deadline)
+		g_main_context_iteration (NULL, FALSE);
+
+	if (settled_us)
+		*settled_us = g_get_monotonic_time () - start;
+
+	g_signal_handler_disconnect (frame_clock, handler_id);
+	gtk_window_destroy (GTK_WINDOW (window));
+
+	return painted;
+}
+
+/* A fresh font map has no fontsets loaded, as on startup */
+static gboolean
+measure_cold_first_frame (TeclaModel *model,
+			  gboolean    prewarm_fonts,
+			  gint64     *elapsed_us,
+			  gint64     *settled_us)
+{
+	g_autoptr (PangoFontMap) font_map = NULL;
+	gboolean painted;
+
+	font_map = pango_cairo_font_map_new ();
+	tecla_text_cache_set_prewarm_fonts_enabled (prewarm_fonts);
+	painted = measure_first_frame (model, font_map, elapsed_us, settled_us);
+	tecla_text_cache_set_prewarm_fonts_enabled (TRUE);
+
+	return painted;
+}
+
+/* First frames with and without font fallback resolved ahead on a
+ * worker, and how long until every legend is drawn.
+ */
+static gboolean
+bench_font_prewarm (void)
+{
+	const gchar *layouts[] = { "us", "ru", "ara", "in", "jp" };
+	gboolean painted = TRUE;
+	gint64 elapsed_us;
+	gsize i;
+
+	if (!gtk_init_check ()) {
+		print_skipped ("font-prewarm", "no display");
+		return TRUE;
+	}
+
+	for (i = 0; painted && i < G_N_ELEMENTS (layouts); i++) {
+		g_autoptr (TeclaModel) model = NULL;
+		gsize n_codepoints;
+		int prewarm;
+
+		model = tecla_model_new_from_layout_name (layouts[i]);
+		if (!model) {
+			g_printerr ("font-prewarm: could not compile the “%s” layout\n",
+				    layouts[i]);
+			return FALSE;
+		}
+
+		/* Theme and default fonts are loaded once, leave them out */
+		if (i == 0)
+			measure_first_frame (model, NULL, &elapsed_us, NULL);
+
+		tecla_model_get_codepoints (model, &n_codepoints);
+
+		/* One op is a first frame, settled is until all legends are drawn */
+		for (prewarm = FALSE; painted && prewarm <= TRUE; prewarm++) {
+			g_autofree gchar *name = NULL, *extra = NULL;
+			gint64 settled_us;
+			gsize allocs_start;
+			double sample;
+
+			allocs_start = get_n_allocs ();
+			painted = measure_cold_first_frame (model, prewarm,
+							    &elapsed_us, &settled_us);
+			if (!painted)
+				break;
+
+			sample = ns_per_op (elapsed_us, 1);
+			name = g_strdup_printf ("font-prewarm-%s-%s", layouts[i],
+						prewarm ? "on" : "off");
+			extra = g_strdup_printf ("\"codepoints\": %" G_GSIZE_FORMAT ", "
+						 "\"settled_us\": %" G_GINT64_FORMAT,
+						 n_codepoints, settled_us);
+			print_result (name, 1, elapsed_us, get_n_allocs () - allocs_start,
+				      &sample, 1, extra);
+		}
+	}
+
+	if (!painted) {
+		g_printerr ("font-prewarm: %s view was never painted\n", layouts[i - 1]);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+typedef struct
+{
+	TeclaModel *model;
+	TeclaModel *multi_group_model;
+	GPtrArray *key_names;
+	GArray *keycodes;
+	GtkWidget *window;
+	GtkWidget *view;
+	GtkWidget *popover;
+	GdkFrameClock *frame_clock;
+} MicroFixture;
+
+static void
+model_new_op (gpointer data,
+	      gsize    op)
+{
+	/* Nothing else holds these, so each one is built anew */
+	const gchar *layouts[] = { "de", "fr", "es", "it" };
+
+	g_object_unref (tecla_model_new_from_layout_name (layouts[op % G_N_ELEMENTS (layouts)]));
+}
+
+static void
+model_new_shared_op (gpointer data,
+		     gsize    op)
+{
+	g_object_unref (tecla_model_new_from_layout_name ("us"));
+}
+
+static void
+model_get_keyval_op (gpointer data,
+		     gsize    op)
+{
+	MicroFixture *fixture = data;
+	const guint n_keys = fixture->keycodes->len;
+	guint volatile sink;
+
+	sink = tecla_model_get_keyval (fixture->model, (op / n_keys) % 4, 0,
+				       g_array_index (fixture->keycodes, xkb_keycode_t,
+						      op % n_keys));
+	(void) sink;
+}
+
+static void
+model_lookup_key_label_op (gpointer data,
+			   gsize    op)
+{
+	MicroFixture *fixture = data;
+	const guint n_keys = fixture->key_names->len;
+	const gchar * volatile sink;
+
+	sink = tecla_model_lookup_key_label (fixture->model, (op / n_keys) % 4, 0,
+					     g_ptr_array_index (fixture->key_names,
+								op % n_keys));
+	(void) sink;
+}
+
+static void
+model_get_key_label_op (gpointer data,
+			gsize    op)
+{
+	MicroFixture *fixture = data;
+	const guint n_keys = fixture->key_names->len;
+
+	g_free (tecla_model_get_key_label (fixture->model, (op / n_keys) % 4, 0,
+					   g_ptr_array_index (fixture->key_names,
+							      op % n_keys)));
+}
+
+static void
+view_relabel_op (gpointer data,
+		 gsize    op)
+{
+	MicroFixture *fixture = data;
+
+	/* A level switch relabels every key on the next update phase */
+	tecla_view_set_current_level (TECLA_VIEW (fixture->view), op % 2);
+	g_signal_emit_by_name (fixture->frame_clock, "update");
+}
+
+static void
+view_set_group_op (gpointer data,
+		   gsize    op)
+{
+	MicroFixture *fixture = data;
+
+	tecla_view_set_group (TECLA_VIEW (fixture->view), op % 2);
+	g_signal_emit_by_name (fixture->frame_clock, "update");
+}
+
+static void
+popover_set_key_op (gpointer data,
+		    gsize    op)
+{
+	MicroFixture *fixture = data;
+
+	tecla_key_popover_set_key (TECLA_KEY_POPOVER (fixture->popover),
+				   fixture->model, 0,
+				   g_ptr_array_index (fixture->key_names,
+						      op % fixture->key_names->len),
+				   4);
+}
+
+static gboolean
+bench_micro (void)
+{
+	const int n_batches = 100;
+	MicroFixture fixture = { 0, };
+	xkb_keycode_t keycode;
+	guint n_keys;
+
+	fixture.model = tecla_model_new_from_layout_name ("us");
+	fixture.multi_group_model = tecla_model_new_from_layout_name ("us,ru");
+	if (!fixture.model || !fixture.multi_group_model) {
+		g_printerr ("micro: could not compile the “us” and “us,ru” layouts\n");
+		g_clear_object (&fixture.model);
+		g_clear_object (&fixture.multi_group_model);
+		return FALSE;
+	}
+
+	fixture.key_names = g_ptr_array_new ();
+	fixture.keycodes = g_array_new (FALSE, FALSE, sizeof (xkb_keycode_t));
+
+	for (keycode = 8; keycode < 256; keycode++) {
+		const gchar *name = tecla_model_get_keycode_key (fixture.model, keycode);
+
+		if (!name)
+			continue;
+
+		g_ptr_array_add (fixture.key_names, (gpointer) name);
+		g_array_append_val (fixture.keycodes, keycode);
+	}
+
+	n_keys = fixture.key_names->len;
+
+	measure_micro ("model-new-from-layout-name", model_new_op,
+		       &fixture, 4, 25);
+	measure_micro ("model-new-from-layout-name-shared", model_new_shared_op,
+		       &fixture, 1000, n_batches);
+	/* Every key on every level, so every keysym in the layout */
+	measure_micro ("model-get-keyval", model_get_keyval_op,
+		       &fixture, n_keys * 4, n_batches);
+	measure_micro ("model-lookup-key-label", model_lookup_key_label_op,
+		       &fixture, n_keys * 4, n_batches);
+	measure_micro ("model-get-key-label", model_get_key_label_op,
+		       &fixture, n_keys * 4, n_batches);
+
+	if (gtk_init_check ()) {
+		fixture.view = tecla_view_new ();
+		tecla_view_set_model (TECLA_VIEW (fixture.view), fixture.multi_group_model);
+		fixture.window = present_view (fixture.view);
+	}
+
+	if (fixture.window) {
+		fixture.frame_clock = gtk_widget_get_frame_clock (fixture.view);
+		fixture.popover = g_object_ref_sink (tecla_key_popover_new ());
+
+		measure_micro ("view-relabel", view_relabel_op,
+			       &fixture, 20, n_batches);
+		measure_micro ("view-set-group", view_set_group_op,
+			       &fixture, 20, n_batches);
+		measure_micro ("key-popover-set-key", popover_set_key_op,
+			       &fixture, n_keys, n_batches);
+
+		g_object_unref (fixture.popover);
+		gtk_window_destroy (GTK_WINDOW (fixture.window));
+	} else {
+		g_printerr ("micro: view cases skipped, no display\n");
+	}
+
+	g_ptr_array_unref (fixture.key_names);
+	g_array_unref (fixture.keycodes);
+	g_object_unref (fixture.model);
+	g_object_unref (fixture.multi_group_model);
+
+	return TRUE;
+}
+
+#ifdef HAVE_XKBREGISTRY
+#define N_OUTLIERS 10
+
+typedef struct
+{
+	gchar *name; /* layout, or layout+variant */
+	gint64 elapsed_us;
+	gsize n_allocs;
+	gboolean failed;
+} CatalogueEntry;
+
+static void
+catalogue_entry_clear (CatalogueEntry *entry)
+{
+	g_free (entry->name);
+}
+
+static GArray *
+list_catalogue (void)
+{
+	struct rxkb_context *rxkb_context;
+	struct rxkb_layout *layout;
+	GArray *entries;
+
+	rxkb_context = rxkb_context_new (RXKB_CONTEXT_NO_FLAGS);
+	if (!rxkb_context_parse_default_ruleset (rxkb_context)) {
+		rxkb_context_unref (rxkb_context);
+		return NULL;
+	}
+
+	entries = g_array_new (FALSE, TRUE, sizeof (CatalogueEntry));
+	g_array_set_clear_func (entries, (GDestroyNotify) catalogue_entry_clear);
+
+	for (layout = rxkb_layout_first (rxkb_context);
+	     layout;
+	     layout = rxkb_layout_next (layout)) {
+		CatalogueEntry entry = { 0, };
+		const gchar *variant;
+
+		variant = rxkb_layout_get_variant (layout);
+		if (variant) {
+			entry.name = g_strdup_printf ("%s+%s",
+						      rxkb_layout_get_name (layout),
+						      variant);
+		} else {
+			entry.name = g_strdup (rxkb_layout_get_name (layout));
+		}
+
+		g_array_append_val (entries, entry);
+	}
+
+	rxkb_context_unref (rxkb_context);
+
+	return entries;
+}
+
+static void
+compile_entry (CatalogueEntry *entry,
+	       gpointer        user_data)
+{
+	g_autoptr (TeclaModel) model = NULL;
+	const gchar *labels[256 - 8];
+	xkb_keycode_t keycodes[256 - 8];
+	gint64 start;
+	int group, level;
+	gsize i, allocs_start;
+
+	for (i = 0; i < G_N_ELEMENTS (keycodes); i++)
+		keycodes[i] = i + 8;
+
+	/* Counters are per thread, so take them on the worker */
+	allocs_start = get_n_allocs ();
+	start = g_get_monotonic_time ();
+
+	model = tecla_model_new_from_layout_name (entry->name);
+	if (!model) {
+		entry->failed = TRUE;
+		return;
+	}
+
+	/* What a view looks up when first showing the model */
+	for (group = 0; group < tecla_model_get_n_groups (model); group++) {
+		for (level = 0; level < 4; level++) {
+			tecla_model_get_labels (model, level, group,
+						keycodes, G_N_ELEMENTS (keycodes),
+						labels, NULL);
+		}
+	}
+
+	entry->elapsed_us = g_get_monotonic_time () - start;
+	entry->n_allocs = get_n_allocs () - allocs_start;
+}
+
+static int
+compare_entries (gconstpointer a,
+		 gconstpointer b)
+{
+	const CatalogueEntry *ea = a, *eb = b;
+
+	return (eb->elapsed_us > ea->elapsed_us) - (eb->elapsed_us < ea->elapsed_us);
+}
+
+static gboolean
+bench_catalogue (void)
+{
+	g_autoptr (GArray) entries = NULL;
+	g_autoptr (GError) error = NULL;
+	g_autoptr (GString) extra = NULL;
+	g_autofree double *samples = NULL;
+	gchar efficiency[G_ASCII_DTOSTR_BUF_SIZE];
+	GThreadPool *pool;
+	gint64 start, wall_us, busy_us = 0;
+	guint i, n_failed = 0, n_samples = 0, hits_start, misses_start, hits, misses;
+	gsize n_allocs = 0;
+
+	entries = list_catalogue ();
+	if (!entries || entries->len == 0) {
+		print_skipped ("catalogue", "no xkeyboard-config registry");
+		return TRUE;
+	}
+
+	pool = g_thread_pool_new ((GFunc) compile_entry, NULL, n_jobs, TRUE, &error);
+	if (!pool) {
+		g_printerr ("catalogue: %s\n", error->message);
+		return FALSE;
+	}
+
+	/* Cache hits would time reading files back, not compiling */
+	tecla_keymap_cache_set_enabled (use_keymap_cache);
+	tecla_keymap_cache_get_stats (&hits_start, &misses_start);
+
+	start = g_get_monotonic_time ();
+	for (i = 0; i < entries->len; i++)
+		g_thread_pool_push (pool, &g_array_index (entries, CatalogueEntry, i), NULL);
+	g_thread_pool_free (pool, FALSE, TRUE);
+	wall_us = g_get_monotonic_time () - start;
+
+	tecla_keymap_cache_get_stats (&hits, &misses);
+	tecla_keymap_cache_set_enabled (TRUE);
+
+	g_array_sort (entries, compare_entries);
+	samples = g_new (double, entries->len);
+
+	for (i = 0; i < entries->len; i++) {
+		CatalogueEntry *entry = &g_array_index (entries, CatalogueEntry, i);
+
+		if (entry->failed) {
+			g_printerr ("catalogue: could not compile “%s”\n", entry->name);
+			n_failed++;
+			continue;
+		}
+
+		samples[n_samples++] = ns_per_op (entry->elapsed_us, 1);
+		busy_us += entry->elapsed_us;
+		n_allocs += entry->n_allocs;
+	}
+
+	/* ns/op is wall time per layout, percentiles are per-layout
+	 * compile times. These growing with -j point at contention.
+	 */
+	g_ascii_formatd (efficiency, sizeof (efficiency), "%.2f",
+			 (double) busy_us / MAX (wall_us * n_jobs, 1));
+	extra = g_string_new (NULL);
+	g_string_append_printf (extra,
+				"\"failed\": %u, \"jobs\": %d, "
+				"\"parallel_efficiency\": %s, "
+				"\"keymap_cache\": %s, \"cache_hits\": %u, "
+				"\"cache_misses\": %u, \"slowest\": [",
+				n_failed, n_jobs, efficiency,
+				use_keymap_cache ? "true" : "false",
+				hits - hits_start, misses - misses_start);
+
+	for (i = 0; i < MIN (entries->len, N_OUTLIERS); i++) {
+		CatalogueEntry *entry = &g_array_index (entries, CatalogueEntry, i);
+
+		g_string_append_printf (extra, "%s\"%s\"", i > 0 ? ", " : "",
+					entry->name);
+	}
+
+	g_string_append_c (extra, ']');
+
+	print_result ("catalogue", entries->len, wall_us, n_allocs,
+		      samples, n_samples, extra->str);
+
+	return n_failed == 0;
+}
+#endif
+
+#ifdef HAVE_TEST_COMPOSITOR
+typedef enum
+{
+	STEP_KEYMAP,
+	STEP_GROUP,
+	STEP_SEAT_ADD,
+	STEP_SEAT_REMOVE,
+} StepType;
+
+typedef struct
+{
+	StepType type;
+	gchar *arg; /* layout, group or seat name */
+	gchar *seat; /* NULL for the first seat */
+} TraceStep;
+
+static void
+trace_step_clear (TraceStep *step)
+{
+	g_free (step->arg);
+	g_free (step->seat);
+}
+
+/* One step per line: “keymap LAYOUT [SEAT]”, “group N [SEAT]”,
+ * “seat-add SEAT” or “seat-remove SEAT”. The trace is replayed
+ * until the number of events is reached.
+ */
+static GArray *
+load_trace (const gchar  *path,
+	    GError      **error)
+{
+	g_autofree gchar *contents = NULL;
+	g_auto (GStrv) lines = NULL;
+	GArray *trace;
+	int i;
+
+	if (!g_file_get_contents (path, &contents, NULL, error))
+		return NULL;
+
+	trace = g_array_new (FALSE, TRUE, sizeof (TraceStep));
+	g_array_set_clear_func (trace, (GDestroyNotify) trace_step_clear);
+	lines = g_strsplit (contents, "\n", -1);
+
+	for (i = 0; lines[i]; i++) {
+		g_auto (GStrv) words = NULL;
+		TraceStep step = { 0, };
+
+		words = g_strsplit_set (g_strstrip (lines[i]), " \t", 3);
+		if (!words[0] || !*words[0] || words[0][0] == '#')
+			continue;
+
+		if (g_str_equal (words[0], "keymap")) {
+			step.type = STEP_KEYMAP;
+		} else if (g_str_equal (words[0], "group")) {
+			step.type = STEP_GROUP;
+		} else if (g_str_equal (words[0], "seat-add")) {
+			step.type = STEP_SEAT_ADD;
+		} else if (g_str_equal (words[0], "seat-remove")) {
+			step.type = STEP_SEAT_REMOVE;
+		} else {
+			g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+				     "%s:%d: unknown step “%s”", path, i + 1, words[0]);
+			g_array_unref (trace);
+			return NULL;
+		}
+
+		if (!words[1]) {
+			g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+				     "%s:%d: missing argument", path, i + 1);
+			g_array_unref (trace);
+			return NULL;
+		}
+
+		step.arg = g_strdup (words[1]);
+		step.seat = g_strdup (words[2]);
+		g_array_append_val (trace, step);
+	}
+
+	return trace;
+}
+
+/* Keymap changes across a few layouts, with a group flip every 10
+ * events and a second seat plugged and unplugged every 1000. Every
+ * step changes something, so every step gets a notification.
+ */
+static GArray *
+default_trace (void)
+{
+	const gchar *layouts[] = { "us", "de", "fr", "ru" };
+	GArray *trace;
+	int i, n_flips = 0;
+
+	trace = g_array_new (FALSE, TRUE, sizeof (TraceStep));
+	g_array_set_clear_func (trace, (GDestroyNotify) trace_step_clear);
+
+	for (i = 0; i < 1000; i++) {
+		TraceStep step = { 0, };
+
+		if (i == 500) {
+			step.type = STEP_SEAT_ADD;
+			step.arg = g_strdup ("seat1");
+		} else if (i == 501) {
+			step.type = STEP_KEYMAP;
+			step.arg = g_strdup ("de");
+			step.seat = g_strdup ("seat1");
+		} else if (i == 999) {
+			step.type = STEP_SEAT_REMOVE;
+			step.arg = g_strdup ("seat1");
+		} else if (i % 10 == 5) {
+			/* Seats start on group 0, and there's an even
+			 * number of flips so replays start over from it.
+			 */
+			step.type = STEP_GROUP;
+			step.arg = g_strdup_printf ("%d", ++n_flips % 2);
+		} else {
+			step.type = STEP_KEYMAP;
+			step.arg = g_strdup (layouts[i % G_N_ELEMENTS (layouts)]);
+		}
+
+		g_array_append_val (trace, step);
+	}
+
+	return trace;
+}
+
+typedef struct
+{
+	gchar *text;
+	gchar *digest; /* What the observer reports for it */
+} KeymapText;
+
+static void
+keymap_text_free (KeymapText *keymap)
+{
+	free (keymap->text);
+	g_free (keymap->digest);
+	g_free (keymap);
+}
+
+static const KeymapText *
+get_keymap_text (GHashTable  *keymaps,
+		 const gchar *layout)
+{
+	struct xkb_rule_names rule_names = { 0, };
+	struct xkb_context *xkb_context;
+	struct xkb_keymap *xkb_keymap;
+	KeymapText *keymap;
+
+	keymap = g_hash_table_lookup (keymaps, layout);
+	if (keymap)
+		return keymap;
+
+	rule_names.layout = layout;
+	xkb_context = tecla_util_get_xkb_context ();
+	xkb_keymap = xkb_keymap_new_from_names (xkb_context, &rule_names,
+						XKB_KEYMAP_COMPILE_NO_FLAGS);
+	xkb_context_unref (xkb_context);
+	if (!xkb_keymap)
+		return NULL;
+
+	keymap = g_new0 (KeymapText, 1);
+	keymap->text = xkb_keymap_get_as_string (xkb_keymap, XKB_KEYMAP_FORMAT_TEXT_V1);
+	keymap->digest = g_compute_checksum_for_string (G_CHECKSUM_SHA256,
+							keymap->text, -1);
+	xkb_keymap_unref (xkb_keymap);
+	g_hash_table_insert (keymaps, g_strdup (layout), keymap);
+
+	return keymap;
+}
+
+static guint
+count_handlers (gpointer instance)
+{
+	guint n_handlers = 0;
+	GType type;
+
+	for (type = G_TYPE_FROM_INSTANCE (instance); type; type = g_type_parent (type)) {
+		g_autofree guint *ids = NULL;
+		guint n_ids, i;
+
+		ids = g_signal_list_ids (type, &n_ids);
+		for (i = 0; i < n_ids; i++) {
+			/* Blocking tells how many handlers matched */
+			n_handlers += g_signal_handlers_block_matched (instance, G_SIGNAL_MATCH_ID,
+								       ids[i], 0, NULL, NULL, NULL);
+			g_signal_handlers_unblock_matched (instance, G_SIGNAL_MATCH_ID,
+							   ids[i], 0, NULL, NULL, NULL);
+		}
+	}
+
+	return n_handlers;
+}
+
+static const gchar *
+get_step_seat (const TraceStep *step)
+{
+	if (step->type == STEP_SEAT_ADD || step->type == STEP_SEAT_REMOVE)
+		return step->arg;
+
+	return step->seat ? step->seat : "seat0";
+}
+
+static gboolean
+has_seat (TeclaKeymapObserver *observer,
+	  const gchar         *seat)
+{
+	g_auto (GStrv) seats = NULL;
+
+	seats = tecla_keymap_observer_get_seats (observer);
+
+	return g_strv_contains ((const gchar * const *) seats, seat);
+}
+
+/* The notification a step is waiting for */
+typedef struct
+{
+	const TraceStep *step;
+	const gchar *seat;
+	const gchar *digest; /* Keymap steps only */
+	gint64 time; /* Of the matching emission, 0 until then */
+} StepMatch;
+
+static gboolean
+is_step_applied (TeclaKeymapObserver *observer,
+		 const StepMatch     *match)
+{
+	switch (match->step->type) {
+	case STEP_KEYMAP:
+		return g_strcmp0 (tecla_keymap_observer_get_seat_digest (observer, match->seat),
+				  match->digest) == 0;
+	case STEP_GROUP:
+		return has_seat (observer, match->seat) &&
+			tecla_keymap_observer_get_seat_group (observer, match->seat) ==
+			atoi (match->step->arg);
+	case STEP_SEAT_ADD:
+		return has_seat (observer, match->seat);
+	case STEP_SEAT_REMOVE:
+		return !has_seat (observer, match->seat);
+	default:
+		g_assert_not_reached ();
+	}
+}
+
+static void
+seat_changed_cb (TeclaKeymapObserver *observer,
+		 const gchar         *seat,
+		 StepMatch           *match)
+{
+	/* Leftovers from earlier steps may still come through */
+	if (match->time == 0 &&
+	    g_strcmp0 (seat, match->seat) == 0 &&
+	    is_step_applied (observer, match))
+		match->time = g_get_monotonic_time ();
+}
+
+/* Does what the main window does on keymap changes */
+static void
+observer_keymap_cb (TeclaKeymapObserver *observer,
+		    GParamSpec          *pspec,
+		    GtkWindow           *window)
+{
+	TeclaView *view = TECLA_VIEW (gtk_window_get_child (window));
+
+	tecla_view_set_group (view, tecla_keymap_observer_get_group (observer));
+	tecla_application_connect_model (window, view,
+					 tecla_keymap_observer_get_model (observer));
+}
+
+static void
+observer_group_cb (TeclaKeymapObserver *observer,
+		   GParamSpec          *pspec,
+		   TeclaView           *view)
+{
+	tecla_view_set_group (view, tecla_keymap_observer_get_group (observer));
+}
+
+static gboolean
+wake_up_cb (gpointer user_data)
+{
+	return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+run_step (TeclaTestCompositor *compositor,
+	  GHashTable          *seats,
+	  GHashTable          *keymaps,
+	  const TraceStep     *step,
+	  GError             **error)
+{
+	const gchar *seat_name = get_step_seat (step);
+	const KeymapText *keymap;
+	guint seat;
+
+	if (step->type == STEP_SEAT_ADD) {
+		seat = tecla_test_compositor_add_seat (compositor, seat_name);
+		g_hash_table_insert (seats, g_strdup (seat_name), GUINT_TO_POINTER (seat));
+		return TRUE;
+	}
+
+	seat = GPOINTER_TO_UINT (g_hash_table_lookup (seats, seat_name));
+	if (seat == 0) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+			     "No seat “%s”", seat_name);
+		return FALSE;
+	}
+
+	switch (step->type) {
+	case STEP_KEYMAP:
+		keymap = get_keymap_text (keymaps, step->arg);
+		if (!keymap) {
+			g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+				     "Could not compile the “%s” layout", step->arg);
+			return FALSE;
+		}
+		return tecla_test_compositor_send_keymap (compositor, seat, keymap->text, error);
+	case STEP_GROUP:
+		tecla_test_compositor_send_group (compositor, seat, atoi (step->arg));
+		return TRUE;
+	case STEP_SEAT_REMOVE:
+		tecla_test_compositor_remove_seat (compositor, seat);
+		g_hash_table_remove (seats, seat_name);
+		return TRUE;
+	default:
+		g_assert_not_reached ();
+	}
+}
+
+static gboolean
+bench_observer (void)
+{
+	const gchar *trace_path = g_getenv ("TECLA_BENCH_TRACE");
+	const gchar *env;
+	g_autoptr (TeclaTestCompositor) compositor = NULL;
+	g_autoptr (GHashTable) seats = NULL;
+	g_autoptr (GHashTable) keymaps = NULL;
+	g_autoptr (GArray) trace = NULL;
+	g_autoptr (GArray) latencies = NULL;
+	g_autoptr (GError) error = NULL;
+	TeclaKeymapObserver *observer;
+	struct wl_display *wl_display;
+	GtkWidget *window = NULL, *view = NULL;
+	g_autofree gchar *extra = NULL;
+	gsize rss_start = 0, rss_end, allocs_start;
+	guint n_handlers_start = 0, n_handlers_end, n_missed = 0, n_unchanged = 0, wake_up_id;
+	gint64 start, step_start, deadline, total = 0, max_rss_growth = -1;
+	gboolean success;
+	int n_events = 100000, rate = 0, event;
+
+	env = g_getenv ("TECLA_BENCH_EVENTS");
+	if (env)
+		n_events = MAX (atoi (env), 1);
+	env = g_getenv ("TECLA_BENCH_RATE");
+	if (env)
+		rate = atoi (env);
+	/* In KiB, past warm-up, the test run fails beyond it */
+	env = g_getenv ("TECLA_BENCH_MAX_RSS_GROWTH");
+	if (env)
+		max_rss_growth = g_ascii_strtoll (env, NULL, 10);
+
+	trace = trace_path ? load_trace (trace_path, &error) : default_trace ();
+	if (!trace || trace->len == 0) {
+		g_printerr ("observer: %s\n", error ? error->message : "empty trace");
+		return FALSE;
+	}
+
+	compositor = tecla_test_compositor_new (&error);
+	if (!compositor) {
+		g_printerr ("observer: %s\n", error->message);
+		print_skipped ("observer", "no test compositor");
+		return TRUE;
+	}
+
+	seats = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	keymaps = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+					 (GDestroyNotify) keymap_text_free);
+	g_hash_table_insert (seats, g_strdup ("seat0"),
+			     GUINT_TO_POINTER (tecla_test_compositor_add_seat (compositor, "seat0")));
+
+	wl_display = wl_display_connect (tecla_test_compositor_get_socket (compositor));
+	if (!wl_display) {
+		g_printerr ("observer: could not connect to the test compositor\n");
+		return FALSE;
+	}
+
+	observer = tecla_keymap_observer_new_for_wl_display (wl_display);
+
+	/* The window only needs a display to exist, it is never shown */
+	if (gtk_init_check ()) {
+		window = gtk_window_new ();
+		view = tecla_view_new ();
+		gtk_window_set_child (GTK_WINDOW (window), view);
+		g_signal_connect (observer, "notify::keymap",
+				  G_CALLBACK (observer_keymap_cb), window);
+		g_signal_connect (observer, "notify::group",
+				  G_CALLBACK (observer_group_cb), view);
+	}
+
+	/* Let the initial seat through before timing anything */
+	deadline = g_get_monotonic_time () + G_USEC_PER_SEC;
+	while (!has_seat (observer, "seat0") && g_get_monotonic_time () < deadline)
+		g_main_context_iteration (NULL, TRUE);
+
+	latencies = g_array_sized_new (FALSE, FALSE, sizeof (double), n_events);
+	wake_up_id = g_timeout_add (10, wake_up_cb, NULL);
+	allocs_start = get_n_allocs ();
+	start = g_get_monotonic_time ();
+
+	for (event = 0; event < n_events; event++) {
+		const TraceStep *step = &g_array_index (trace, TraceStep, event % trace->len);
+		StepMatch match = { step, get_step_seat (step), NULL, 0 };
+		const KeymapText *keymap;
+		gboolean unchanged;
+		gulong handler_id;
+		double latency;
+
+		/* Leave warm-up out of the growth figures */
+		if (event == MIN ((int) trace->len, n_events / 2)) {
+			rss_start = get_rss_kb ();
+			n_handlers_start = count_handlers (observer) +
+				(view ? count_handlers (view) : 0);
+		}
+
+		if (step->type == STEP_KEYMAP) {
+			keymap = get_keymap_text (keymaps, step->arg);
+			match.digest = keymap ? keymap->digest : NULL;
+		}
+
+		/* Traces may repeat a state, that emits nothing */
+		unchanged = is_step_applied (observer, &match);
+
+		handler_id = g_signal_connect (observer, "seat-changed",
+					       G_CALLBACK (seat_changed_cb), &match);
+
+		step_start = g_get_monotonic_time ();
+		if (!run_step (compositor, seats, keymaps, step, &error)) {
+			g_printerr ("observer: %s\n", error->message);
+			g_signal_handler_disconnect (observer, handler_id);
+			break;
+		}
+
+		deadline = step_start + G_USEC_PER_SEC;
+		while (!unchanged && match.time == 0 &&
+		       g_get_monotonic_time () < deadline)
+			g_main_context_iteration (NULL, TRUE);
+
+		g_signal_handler_disconnect (observer, handler_id);
+
+		if (unchanged) {
+			n_unchanged++;
+			continue;
+		} else if (match.time == 0) {
+			n_missed++;
+			continue;
+		}
+
+		latency = ns_per_op (match.time - step_start, 1);
+		g_array_append_val (latencies, latency);
+		total += match.time - step_start;
+
+		if (rate > 0) {
+			gint64 next = start + (gint64) (event + 1) * G_USEC_PER_SEC / rate;
+
+			while (g_get_monotonic_time () < next)
+				g_main_context_iteration (NULL, TRUE);
+		}
+	}
+
+	g_source_remove (wake_up_id);
+	rss_end = get_rss_kb ();
+
+	n_handlers_end = count_handlers (observer) + (view ? count_handlers (view) : 0);
+
+	/* One op is a step that got its notification */
+	extra = g_strdup_printf ("\"missed\": %u, \"unchanged\": %u, "
+				 "\"rss_kib\": %" G_GINT64_FORMAT ", "
+				 "\"handlers_start\": %u, \"handlers_end\": %u",
+				 n_missed, n_unchanged,
+				 (gint64) rss_end - (gint64) rss_start,
+				 n_handlers_start, n_handlers_end);
+	print_result ("observer", latencies->len, total,
+		      get_n_allocs () - allocs_start,
+		      (double *) latencies->data, latencies->len, extra);
+
+	success = error == NULL && n_missed == 0;
+
+	/* Every step reconnects the view, that must not pile up handlers */
+	if (n_handlers_end > n_handlers_start) {
+		g_printerr ("observer: signal handlers grew from %u to %u\n",
+			    n_handlers_start, n_handlers_end);
+		success = FALSE;
+	}
+
+	if (max_rss_growth >= 0 &&
+	    (gint64) rss_end - (gint64) rss_start > max_rss_growth) {
+		g_printerr ("observer: RSS grew by more than %" G_GINT64_FORMAT " KiB\n",
+			    max_rss_growth);
+		success = FALSE;
+	}
+
+	if (n_missed > 0)
+		g_printerr ("observer: %u steps got no matching notification\n", n_missed);
+
+	if (window)
+		gtk_window_destroy (GTK_WINDOW (window));
+	g_object_unref (observer);
+	wl_display_disconnect (wl_display);
+
+	return success;
+}
+#endif
+
+static const BenchCase cases[] = {
+	{ "labels", bench_labels },
+	{ "key-events", bench_key_events },
+	{ "render", bench_render },
+	{ "text-cache", bench_text_cache },
+	{ "font-prewarm", bench_font_prewarm },
+	{ "micro", bench_micro },
+#ifdef HAVE_XKBREGISTRY
+	{ "catalogue", bench_catalogue },
+#endif
+#ifdef HAVE_TEST_COMPOSITOR
+	{ "observer", bench_observer },
+#endif
+};
+
+int
+main (int   argc,
+      char *argv[])
+{
+	const GOptionEntry entries[] = {
+		{ "jobs", 'j', 0, G_OPTION_ARG_INT, &n_jobs,
+		  "Worker threads for the catalogue case", "N" },
+		{ "keymap-cache", 0, 0, G_OPTION_ARG_NONE, &use_keymap_cache,
+		  "Let the catalogue case use the keymap cache", NULL },
+		{ NULL },
+	};
+	g_autoptr (GOptionContext) context = NULL;
+	g_autoptr (GError) error = NULL;
+	gboolean success = TRUE;
+	gsize i;
+
+	context = g_option_context_new ("[CASE…]");
+	g_option_context_add_main_entries (context, entries, NULL);
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("%s\n", error->message);
+		return EXIT_FAILURE;
+	}
+
+	n_jobs = MAX (n_jobs, 1);
+
+	for (i = 0; i < G_N_ELEMENTS (cases); i++) {
+		if (argc > 1 && !g_strv_contains ((const gchar * const *) &argv[1],
+						  cases[i].name))
+			continue;
+
+		if (!cases[i].run ())
+			success = FALSE;
+	}
+
+	return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,331 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/* A compositor that only knows about seats and keyboards, enough to
+ * drive TeclaKeymapObserver. It runs from the GLib main context.
+ */
+
+#include "config.h"
+
+#include "tecla-test-compositor.h"
+
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <glib-unix.h>
+#include <string.h>
+#include <unistd.h>
+#include <wayland-server.h>
+
+typedef struct
+{
+	TeclaTestCompositor *compositor;
+	guint id;
+	gchar *name;
+	struct wl_global *global;
+	struct wl_list resources; /* wl_seat wl_resource links */
+	struct wl_list keyboards; /* wl_keyboard wl_resource links */
+	gchar *keymap;
+	guint32 group;
+} TestSeat;
+
+struct _TeclaTestCompositor
+{
+	struct wl_display *wl_display;
+	const gchar *socket;
+	guint source_id;
+	GHashTable *seats; /* id → TestSeat */
+	guint next_seat_id;
+	guint32 serial;
+};
+
+static void
+keyboard_release (struct wl_client   *client,
+		  struct wl_resource *resource)
+{
+	wl_resource_destroy (resource);
+}
+
+static const struct wl_keyboard_interface keyboard_impl = {
+	keyboard_release,
+};
+
+static void
+unlink_resource (struct wl_resource *resource)
+{
+	wl_list_remove (wl_resource_get_link (resource));
+}
+
+static gboolean
+send_keymap_to (struct wl_resource  *keyboard,
+		const gchar         *keymap,
+		GError             **error)
+{
+	g_autofree gchar *path = NULL;
+	gsize size;
+	int fd;
+
+	/* Clients map it with the size given, nul included */
+	size = strlen (keymap) + 1;
+	fd = g_file_open_tmp ("tecla-keymap-XXXXXX", &path, error);
+	if (fd < 0)
+		return FALSE;
+
+	g_unlink (path);
+
+	if (write (fd, keymap, size) != (gssize) size) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+			     "Could not write keymap");
+		close (fd);
+		return FALSE;
+	}
+
+	/* The fd is duplicated while marshalling */
+	wl_keyboard_send_keymap (keyboard, WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1,
+				 fd, size);
+	close (fd);
+
+	return TRUE;
+}
+
+static void
+seat_get_keyboard (struct wl_client   *client,
+		   struct wl_resource *resource,
+		   uint32_t            id)
+{
+	TestSeat *seat = wl_resource_get_user_data (resource);
+	struct wl_resource *keyboard;
+
+	keyboard = wl_resource_create (client, &wl_keyboard_interface,
+				       wl_resource_get_version (resource), id);
+
+	/* The seat may have been unplugged meanwhile */
+	if (!seat) {
+		wl_resource_set_implementation (keyboard, &keyboard_impl, NULL, NULL);
+		return;
+	}
+
+	wl_resource_set_implementation (keyboard, &keyboard_impl, seat,
+					unlink_resource);
+	wl_list_insert (&seat->keyboards, wl_resource_get_link (keyboard));
+
+	if (seat->keymap)
+		send_keymap_to (keyboard, seat->keymap, NULL);
+
+	wl_keyboard_send_modifiers (keyboard, ++seat->compositor->serial,
+				    0, 0, 0, seat->group);
+}
+
+static void
+seat_get_unsupported (struct wl_client   *client,
+		      struct wl_resource *resource,
+		      uint32_t            id)
+{
+	wl_resource_post_error (resource, WL_SEAT_ERROR_MISSING_CAPABILITY,
+				"Only keyboards are supported");
+}
+
+static void
+seat_release (struct wl_client   *client,
+	      struct wl_resource *resource)
+{
+	wl_resource_destroy (resource);
+}
+
+static const struct wl_seat_interface seat_impl = {
+	seat_get_unsupported,
+	seat_get_keyboard,
+	seat_get_unsupported,
+	seat_release,
+};
+
+static void
+bind_seat (struct wl_client *client,
+	   void             *data,
+	   uint32_t          version,
+	   uint32_t          id)
+{
+	TestSeat *seat = data;
+	struct wl_resource *resource;
+
+	resource = wl_resource_create (client, &wl_seat_interface, version, id);
+	wl_resource_set_implementation (resource, &seat_impl, seat, unlink_resource);
+	wl_list_insert (&seat->resources, wl_resource_get_link (resource));
+
+	wl_seat_send_capabilities (resource, WL_SEAT_CAPABILITY_KEYBOARD);
+	if (version >= WL_SEAT_NAME_SINCE_VERSION)
+		wl_seat_send_name (resource, seat->name);
+}
+
+static void
+detach_resources (struct wl_list *resources)
+{
+	struct wl_resource *resource, *tmp;
+
+	wl_resource_for_each_safe (resource, tmp, resources) {
+		wl_resource_set_user_data (resource, NULL);
+		wl_list_remove (wl_resource_get_link (resource));
+		wl_list_init (wl_resource_get_link (resource));
+	}
+}
+
+static void
+test_seat_free (TestSeat *seat)
+{
+	/* Resources outlive the global, keep them from pointing here */
+	detach_resources (&seat->resources);
+	detach_resources (&seat->keyboards);
+
+	wl_global_destroy (seat->global);
+	g_free (seat->name);
+	g_free (seat->keymap);
+	g_free (seat);
+}
+
+static gboolean
+dispatch_cb (int           fd,
+	     GIOCondition  condition,
+	     gpointer      user_data)
+{
+	TeclaTestCompositor *compositor = user_data;
+
+	wl_event_loop_dispatch (wl_display_get_event_loop (compositor->wl_display), 0);
+	wl_display_flush_clients (compositor->wl_display);
+
+	return G_SOURCE_CONTINUE;
+}
+
+TeclaTestCompositor *
+tecla_test_compositor_new (GError **error)
+{
+	TeclaTestCompositor *compositor;
+	struct wl_event_loop *loop;
+
+	compositor = g_new0 (TeclaTestCompositor, 1);
+	compositor->wl_display = wl_display_create ();
+	compositor->seats = g_hash_table_new_full (NULL, NULL, NULL,
+						   (GDestroyNotify) test_seat_free);
+	compositor->next_seat_id = 1;
+
+	compositor->socket = wl_display_add_socket_auto (compositor->wl_display);
+	if (!compositor->socket) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+			     "Could not add a Wayland socket");
+		tecla_test_compositor_free (compositor);
+		return NULL;
+	}
+
+	loop = wl_display_get_event_loop (compositor->wl_display);
+	compositor->source_id = g_unix_fd_add (wl_event_loop_get_fd (loop), G_IO_IN,
+					       dispatch_cb, compositor);
+
+	return compositor;
+}
+
+void
+tecla_test_compositor_free (TeclaTestCompositor *compositor)
+{
+	g_clear_handle_id (&compositor->source_id, g_source_remove);
+	g_hash_table_unref (compositor->seats);
+	wl_display_destroy_clients (compositor->wl_display);
+	wl_display_destroy (compositor->wl_display);
+	g_free (compositor);
+}
+
+const gchar *
+tecla_test_compositor_get_socket (TeclaTestCompositor *compositor)
+{
+	return compositor->socket;
+}
+
+guint
+tecla_test_compositor_add_seat (TeclaTestCompositor *compositor,
+				const gchar         *name)
+{
+	TestSeat *seat;
+
+	seat = g_new0 (TestSeat, 1);
+	seat->compositor = compositor;
+	seat->id = compositor->next_seat_id++;
+	seat->name = g_strdup (name);
+	wl_list_init (&seat->resources);
+	wl_list_init (&seat->keyboards);
+	seat->global = wl_global_create (compositor->wl_display,
+					 &wl_seat_interface, 2,
+					 seat, bind_seat);
+
+	g_hash_table_insert (compositor->seats, GUINT_TO_POINTER (seat->id), seat);
+	wl_display_flush_clients (compositor->wl_display);
+
+	return seat->id;
+}
+
+void
+tecla_test_compositor_remove_seat (TeclaTestCompositor *compositor,
+				   guint                seat)
+{
+	g_hash_table_remove (compositor->seats, GUINT_TO_POINTER (seat));
+	wl_display_flush_clients (compositor->wl_display);
+}
+
+gboolean
+tecla_test_compositor_send_keymap (TeclaTestCompositor  *compositor,
+				   guint                 seat_id,
+				   const gchar          *keymap,
+				   GError              **error)
+{
+	struct wl_resource *keyboard;
+	TestSeat *seat;
+
+	seat = g_hash_table_lookup (compositor->seats, GUINT_TO_POINTER (seat_id));
+	g_return_val_if_fail (seat != NULL, FALSE);
+
+	g_free (seat->keymap);
+	seat->keymap = g_strdup (keymap);
+
+	wl_resource_for_each (keyboard, &seat->keyboards) {
+		if (!send_keymap_to (keyboard, keymap, error))
+			return FALSE;
+	}
+
+	wl_display_flush_clients (compositor->wl_display);
+
+	return TRUE;
+}
+
+void
+tecla_test_compositor_send_group (TeclaTestCompositor *compositor,
+				  guint                seat_id,
+				  guint32              group)
+{
+	struct wl_resource *keyboard;
+	TestSeat *seat;
+
+	seat = g_hash_table_lookup (compositor->seats, GUINT_TO_POINTER (seat_id));
+	g_return_if_fail (seat != NULL);
+
+	seat->group = group;
+
+	wl_resource_for_each (keyboard, &seat->keyboards) {
+		wl_keyboard_send_modifiers (keyboard, ++compositor->serial,
+					    0, 0, 0, group);
+	}
+
+	wl_display_flush_clients (compositor->wl_display);
+}
@@ -0,0 +1,48 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <glib.h>
+
+#pragma once
+
+typedef struct _TeclaTestCompositor TeclaTestCompositor;
+
+TeclaTestCompositor * tecla_test_compositor_new (GError **error);
+
+void tecla_test_compositor_free (TeclaTestCompositor *compositor);
+
+const gchar * tecla_test_compositor_get_socket (TeclaTestCompositor *compositor);
+
+guint tecla_test_compositor_add_seat (TeclaTestCompositor *compositor,
+				      const gchar         *name);
+
+void tecla_test_compositor_remove_seat (TeclaTestCompositor *compositor,
+					guint                seat);
+
+gboolean tecla_test_compositor_send_keymap (TeclaTestCompositor  *compositor,
+					    guint                 seat,
+					    const gchar          *keymap,
+					    GError              **error);
+
+void tecla_test_compositor_send_group (TeclaTestCompositor *compositor,
+				       guint                seat,
+				       guint32              group);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (TeclaTestCompositor, tecla_test_compositor_free)
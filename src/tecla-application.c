@@ -19,32 +19,35 @@
  */
 
 #include "config.h"
-#include "tecla-application.h"
+#include "tecla-application-private.h"
 
-#include "tecla-key.h"
+#include "tecla-key-popover.h"
+#include "tecla-keymap-cache.h"
 #include "tecla-keymap-observer.h"
 #include "tecla-model.h"
 #include "tecla-view.h"
 
 #include <glib/gi18n.h>
 #include <stdlib.h>
+#include <string.h>
 
 #ifdef GDK_WINDOWING_WAYLAND
 #include <gdk/wayland/gdkwayland.h>
 #endif
 
-typedef struct
-{
-	int level;
-	guint keyval;
-} KeyInfo;
+#define DEFAULT_POOL_SIZE 2
+#define POOL_TIMEOUT_SECONDS 60
 
 typedef struct
 {
 	GtkWindow *window;
 	TeclaView *view;
+	GtkEditable *search;
 	TeclaModel *model;
+	GCancellable *cancellable;
+	gchar *parent_handle;
 	gulong remove_handler_id;
+	gboolean pooled;
 } TeclaInstance;
 
 struct _TeclaApplication
@@ -53,6 +56,10 @@ struct _TeclaApplication
 	TeclaKeymapObserver *observer;
 	TeclaInstance main;
 	GList *instances; /* TeclaInstance* */
+	TeclaInstance *pending; /* Instance whose model is being compiled */
+	GQueue pool; /* TeclaInstance*, hidden layout windows, most recent first */
+	guint pool_timeout_id;
+	int pool_size;
 	gchar *layout;
 	gchar *parent_handle;
 };
@@ -73,6 +80,11 @@ tecla_application_command_line (GApplication            *app,
 	options = g_application_command_line_get_options_dict (cl);
 	argv = g_application_command_line_get_arguments (cl, &argc);
 
+	if (g_variant_dict_contains (options, "no-cache"))
+		tecla_keymap_cache_set_enabled (FALSE);
+
+	g_variant_dict_lookup (options, "pool-size", "i", &tecla_app->pool_size);
+
 	if (argc > 1) {
 		g_set_str (&tecla_app->layout, argv[1]);
 		g_set_str (&tecla_app->parent_handle, NULL);
@@ -87,6 +99,8 @@ tecla_application_command_line (GApplication            *app,
 const GOptionEntry all_options[] = {
 	{ "parent-handle", 0, 0, G_OPTION_ARG_STRING, NULL, N_("Attach to a parent window"), N_("Window handle") },
 	{ "version", 0, 0, G_OPTION_ARG_NONE, NULL, N_("Display version number"), NULL },
+	{ "no-cache", 0, 0, G_OPTION_ARG_NONE, NULL, N_("Do not use the compiled keymap cache"), NULL },
+	{ "pool-size", 0, 0, G_OPTION_ARG_INT, NULL, N_("Keep up to N closed layout windows for reuse"), N_("N") },
 	{ NULL, 0, 0, 0, NULL, NULL, NULL } /* end the list */
 };
 
@@ -162,24 +176,88 @@ num_levels_notify_cb (TeclaView  *view,
 }
 
 static void
-update_title (GtkWindow  *window,
-	      TeclaModel *model)
+update_title (GtkWindow *window,
+	      TeclaView *view)
 {
 	g_autofree gchar *title = NULL;
+	TeclaModel *model;
+
+	model = tecla_view_get_model (view);
+	if (!model) {
+		gtk_window_set_title (GTK_WINDOW (window), _("Keyboard Layout"));
+		return;
+	}
 
 	title = g_strdup_printf ("%s ‐ %s", _("Keyboard Layout"),
-				 tecla_model_get_name (model));
+				 tecla_model_get_name (model,
+						       tecla_view_get_group (view)));
 	gtk_window_set_title (GTK_WINDOW (window), title);
 }
 
-static GtkWindow *
-create_window (TeclaApplication  *app,
-	       TeclaView        **view_out)
+static void
+group_notify_cb (TeclaView  *view,
+		 GParamSpec *pspec,
+		 GtkWindow  *window)
+{
+	update_title (window, view);
+}
+
+static void
+search_changed_cb (GtkSearchEntry *entry,
+		   TeclaView      *view)
+{
+	const TeclaKeyPosition *positions, *position = NULL;
+	TeclaModel *model;
+	const gchar *text;
+	gsize n_positions, i;
+	int group;
+
+	model = tecla_view_get_model (view);
+	text = gtk_editable_get_text (GTK_EDITABLE (entry));
+
+	if (!model || !text || !*text) {
+		tecla_view_set_highlighted_key (view, XKB_KEYCODE_INVALID);
+		return;
+	}
+
+	/* Look up the last typed character */
+	positions = tecla_model_lookup_char (model,
+					     g_utf8_get_char (g_utf8_prev_char (text + strlen (text))),
+					     &n_positions);
+	if (n_positions == 0) {
+		tecla_view_set_highlighted_key (view, XKB_KEYCODE_INVALID);
+		return;
+	}
+
+	/* Positions are sorted by group then level, prefer the current group */
+	group = tecla_view_get_group (view);
+	for (i = 0; i < n_positions; i++) {
+		if (positions[i].group == group) {
+			position = &positions[i];
+			break;
+		}
+	}
+
+	if (!position) {
+		position = &positions[0];
+		tecla_view_set_group (view, position->group);
+	}
+
+	if (position->level < tecla_view_get_num_levels (view))
+		tecla_view_set_current_level (view, position->level);
+
+	tecla_view_set_highlighted_key (view, position->keycode);
+}
+
+static void
+create_window (TeclaApplication *app,
+	       TeclaInstance    *instance)
 {
 	g_autoptr (GtkBuilder) builder = NULL;
 	TeclaView *view;
 	GtkWindow *window;
 	GtkBox *levels;
+	GtkSearchEntry *search;
 
 	g_type_ensure (TECLA_TYPE_VIEW);
 
@@ -191,122 +269,65 @@ create_window (TeclaApplication  *app,
 	window = GTK_WINDOW (gtk_builder_get_object (builder, "window"));
 	view = TECLA_VIEW (gtk_builder_get_object (builder, "view"));
 	levels = GTK_BOX (gtk_builder_get_object (builder, "levels"));
+	search = GTK_SEARCH_ENTRY (gtk_builder_get_object (builder, "search"));
 	gtk_application_add_window (GTK_APPLICATION (app), window);
 
 	g_signal_connect (view, "notify::num-levels",
 			  G_CALLBACK (num_levels_notify_cb), levels);
+	g_signal_connect (search, "search-changed",
+			  G_CALLBACK (search_changed_cb), view);
+	g_signal_connect (view, "notify::group",
+			  G_CALLBACK (group_notify_cb), window);
 
-	if (view_out)
-		*view_out = view;
+	/* Keep key presses going to the view, not the search entry */
+	gtk_window_set_focus (window, GTK_WIDGET (view));
 
-	return window;
-}
-
-static void
-name_notify_cb (TeclaModel *model,
-		GParamSpec *pspec,
-		GtkWindow  *window)
-{
-	update_title (window, model);
-}
-
-static gboolean
-unparent_popover (GtkWidget *popover)
-{
-	gtk_widget_unparent (popover);
-	return G_SOURCE_REMOVE;
+	instance->window = window;
+	instance->view = view;
+	instance->search = GTK_EDITABLE (search);
 }
 
 static void
 popover_closed_cb (GtkPopover *popover,
 		   TeclaView  *view)
 {
-	GtkWidget *parent;
+	const gchar *name;
+
+	name = tecla_key_popover_get_key_name (TECLA_KEY_POPOVER (popover));
+	if (name)
+		tecla_view_set_key_active (view, name, FALSE);
 
 	if (current_popover == popover)
 		current_popover = NULL;
-
-	parent = gtk_widget_get_parent (GTK_WIDGET (popover));
-	gtk_widget_unset_state_flags (parent, GTK_STATE_FLAG_ACTIVE);
-
-	g_idle_add ((GSourceFunc) unparent_popover, popover);
 }
 
-static GtkPopover *
-create_popover (TeclaView   *view,
-		TeclaModel  *model,
-		GtkWidget   *widget,
-		const gchar *name)
+static void
+destroy_popover (GtkWidget *popover)
 {
-	int n_levels, i;
-	xkb_keycode_t keycode;
-	GtkPopover *popover;
-	GtkWidget *box;
-	g_autoptr (GArray) key_info = NULL;
-
-	keycode = tecla_model_get_key_keycode (model, name);
-	n_levels = tecla_view_get_num_levels (view);
-
-	key_info = g_array_new (FALSE, TRUE, sizeof (KeyInfo));
-
-	for (i = 0; i < n_levels; i++) {
-		KeyInfo info;
-
-		info.level = i;
-		info.keyval = tecla_model_get_keyval (model,
-						      info.level,
-						      keycode);
-		if (info.keyval == 0)
-			continue;
-
-		g_array_append_val (key_info, info);
-	}
-
-	if (key_info->len < 2)
-		return NULL;
-
-	box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 6);
-	gtk_widget_set_margin_start (box, 12);
-	gtk_widget_set_margin_end (box, 12);
-	gtk_widget_set_margin_top (box, 12);
-	gtk_widget_set_margin_bottom (box, 12);
-
-	for (i = 0; i < (int) key_info->len; i++) {
-		GtkWidget *hbox, *level, *etching, *desc;
-		KeyInfo *info;
-		g_autofree gchar *str;
-
-		info = &g_array_index (key_info, KeyInfo, i);
-
-		hbox = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 6);
-
-		str = g_strdup_printf ("%d", info->level + 1);
-		level = gtk_label_new (str);
-		gtk_widget_add_css_class (level, "heading");
-		gtk_box_append (GTK_BOX (hbox), level);
-
-		str = tecla_model_get_key_label (model, info->level, name);
-		etching = tecla_key_new (NULL);
-		tecla_key_set_label (TECLA_KEY (etching), str);
-		gtk_widget_add_css_class (etching, "tecla-key");
-		gtk_widget_set_sensitive (etching, FALSE);
-		gtk_box_append (GTK_BOX (hbox), etching);
-
-		desc = gtk_label_new (gdk_keyval_name (info->keyval));
-		gtk_box_append (GTK_BOX (hbox), desc);
+	if (current_popover == GTK_POPOVER (popover))
+		current_popover = NULL;
+	if (gtk_widget_get_parent (popover))
+		gtk_widget_unparent (popover);
+	g_object_unref (popover);
+}
 
-		gtk_box_append (GTK_BOX (box), hbox);
-	}
+static TeclaKeyPopover *
+get_view_popover (TeclaView *view)
+{
+	GtkWidget *popover;
 
-	popover = GTK_POPOVER (gtk_popover_new ());
-	gtk_popover_set_child (popover, box);
+	popover = g_object_get_data (G_OBJECT (view), "key-popover");
+	if (popover)
+		return TECLA_KEY_POPOVER (popover);
 
-	gtk_popover_set_autohide (popover, FALSE);
-	gtk_popover_set_position (popover, GTK_POS_TOP);
-	g_signal_connect_after (popover, "closed",
+	/* Kept alive by the view while unparented between clicks */
+	popover = g_object_ref_sink (tecla_key_popover_new ());
+	g_signal_connect (popover, "closed",
 			  G_CALLBACK (popover_closed_cb), view);
+	g_object_set_data_full (G_OBJECT (view), "key-popover", popover,
+				(GDestroyNotify) destroy_popover);
 
-	return popover;
+	return TECLA_KEY_POPOVER (popover);
 }
 
 static void
@@ -315,10 +336,15 @@ key_activated_cb (TeclaView   *view,
 		  GtkWidget   *widget,
 		  TeclaModel  *model)
 {
-	GtkPopover *popover;
+	TeclaKeyPopover *popover;
+	graphene_rect_t bounds;
+	GdkRectangle rect;
 
 	if (current_popover) {
-		if (gtk_widget_get_parent (GTK_WIDGET (current_popover)) == widget) {
+		/* In single-widget mode all keys share the parent */
+		if (gtk_widget_get_parent (GTK_WIDGET (current_popover)) == widget &&
+		    tecla_key_popover_get_key_name (TECLA_KEY_POPOVER (current_popover)) ==
+		    g_intern_string (name)) {
 			gtk_popover_popdown (current_popover);
 			return;
 		}
@@ -329,29 +355,48 @@ key_activated_cb (TeclaView   *view,
 	if (!widget)
 		return;
 
-	popover = create_popover (view, model, widget, name);
+	popover = get_view_popover (view);
+	if (!tecla_key_popover_set_key (popover, model,
+					tecla_view_get_group (view), name,
+					tecla_view_get_num_levels (view)))
+		return;
 
-	if (popover) {
-		gtk_widget_set_parent (GTK_WIDGET (popover), widget);
-		gtk_widget_set_state_flags (widget, GTK_STATE_FLAG_ACTIVE, FALSE);
-		gtk_popover_popup (popover);
-		current_popover = popover;
+	if (tecla_view_get_key_bounds (view, name, &bounds)) {
+		rect = (GdkRectangle) {
+			bounds.origin.x, bounds.origin.y,
+			bounds.size.width, bounds.size.height,
+		};
+	} else {
+		rect = (GdkRectangle) {
+			0, 0,
+			gtk_widget_get_width (widget),
+			gtk_widget_get_height (widget),
+		};
 	}
+
+	tecla_key_popover_popup_at (popover, widget, &rect);
+	tecla_view_set_key_active (view, name, TRUE);
+	current_popover = GTK_POPOVER (popover);
 }
 
-static void
-connect_model (GtkWindow  *window,
-	       TeclaView  *view,
-	       TeclaModel *model)
+/* Also used by the benchmarks, to wire up views like the windows do */
+void
+tecla_application_connect_model (GtkWindow  *window,
+				 TeclaView  *view,
+				 TeclaModel *model)
 {
 	tecla_view_set_model (view, model);
-	g_signal_connect_object (model, "notify::name",
-				 G_CALLBACK (name_notify_cb),
-				 window, 0);
+	update_title (window, view);
 
+	/* Keymap changes reconnect, don't pile up handlers for old models */
+	g_signal_handlers_disconnect_matched (view, G_SIGNAL_MATCH_FUNC,
+					      0, 0, NULL, key_activated_cb, NULL);
 	g_signal_connect_object (view, "key-activated",
 				 G_CALLBACK (key_activated_cb),
 				 model, 0);
+
+	/* Build the details popover up front, clicks only relabel it */
+	get_view_popover (view);
 }
 
 static void
@@ -359,14 +404,14 @@ observer_keymap_notify_cb (TeclaKeymapObserver *observer,
 			   GParamSpec          *pspec,
 			   TeclaApplication    *app)
 {
-	g_autoptr (TeclaModel) model = NULL;
-	struct xkb_keymap *xkb_keymap;
+	TeclaModel *model;
 
-	xkb_keymap = tecla_keymap_observer_get_keymap (observer);
-	model = tecla_model_new_from_xkb_keymap (xkb_keymap);
-	connect_model (app->main.window,
-		       app->main.view, model);
-	update_title (app->main.window, model);
+	/* Compiled on the observer thread already */
+	model = tecla_keymap_observer_get_model (observer);
+	tecla_view_set_group (app->main.view,
+			      tecla_keymap_observer_get_group (observer));
+	tecla_application_connect_model (app->main.window,
+					 app->main.view, model);
 
 	g_set_object (&app->main.model, model);
 }
@@ -379,8 +424,48 @@ observer_keymap_group_cb (TeclaKeymapObserver *observer,
 	int group;
 
 	group = tecla_keymap_observer_get_group (observer);
-	if (app->main.model)
-		tecla_model_set_group (app->main.model, group);
+	if (app->main.view)
+		tecla_view_set_group (app->main.view, group);
+}
+
+static void
+detach_instance (TeclaApplication *tecla_app,
+		 TeclaInstance    *instance)
+{
+	if (instance->cancellable) {
+		g_cancellable_cancel (instance->cancellable);
+		g_clear_object (&instance->cancellable);
+	}
+
+	if (tecla_app->pending == instance)
+		tecla_app->pending = NULL;
+
+	tecla_app->instances =
+		g_list_remove (tecla_app->instances, instance);
+}
+
+static void
+free_instance (TeclaApplication *tecla_app,
+	       TeclaInstance    *instance)
+{
+	detach_instance (tecla_app, instance);
+	g_signal_handler_disconnect (tecla_app, instance->remove_handler_id);
+	g_signal_handlers_disconnect_by_data (instance->window, instance);
+
+	g_clear_object (&instance->model);
+	g_free (instance->parent_handle);
+	g_free (instance);
+}
+
+/* Destroying hides the window first, which must not pool it */
+static void
+destroy_instance (TeclaApplication *tecla_app,
+		  TeclaInstance    *instance)
+{
+	GtkWindow *window = instance->window;
+
+	free_instance (tecla_app, instance);
+	gtk_window_destroy (window);
 }
 
 void
@@ -390,13 +475,141 @@ window_removed_cb (TeclaApplication *tecla_app,
 {
 	TeclaInstance *instance = user_data;
 
-	tecla_app->instances =
-		g_list_remove (tecla_app->instances, instance);
+	/* Pooled windows are taken out of the application on purpose */
+	if (instance->window != window || instance->pooled)
+		return;
 
-	g_signal_handler_disconnect (tecla_app, instance->remove_handler_id);
+	free_instance (tecla_app, instance);
+}
 
+static void
+clear_pool (TeclaApplication *tecla_app)
+{
+	TeclaInstance *instance;
+
+	g_clear_handle_id (&tecla_app->pool_timeout_id, g_source_remove);
+
+	if (g_queue_is_empty (&tecla_app->pool))
+		return;
+
+	while ((instance = g_queue_pop_head (&tecla_app->pool)) != NULL)
+		destroy_instance (tecla_app, instance);
+
+	g_application_release (G_APPLICATION (tecla_app));
+}
+
+static gboolean
+pool_timeout_cb (TeclaApplication *tecla_app)
+{
+	tecla_app->pool_timeout_id = 0;
+	clear_pool (tecla_app);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void
+window_visible_notify_cb (GtkWindow     *window,
+			  GParamSpec    *pspec,
+			  TeclaInstance *instance)
+{
+	TeclaApplication *tecla_app;
+
+	if (gtk_widget_get_visible (GTK_WIDGET (window)) || instance->pooled)
+		return;
+
+	tecla_app = TECLA_APPLICATION (g_application_get_default ());
+
+	if ((int) g_queue_get_length (&tecla_app->pool) >= tecla_app->pool_size) {
+		destroy_instance (tecla_app, instance);
+		return;
+	}
+
+	detach_instance (tecla_app, instance);
+	gtk_editable_set_text (instance->search, "");
+
+	/* Don't show the old layout while the next one compiles */
+	tecla_view_set_model (instance->view, NULL);
 	g_clear_object (&instance->model);
-	g_free (instance);
+	update_title (window, instance->view);
+
+	/* Hidden windows must not keep the application running, the
+	 * pool holds it instead until it times out.
+	 */
+	if (g_queue_is_empty (&tecla_app->pool))
+		g_application_hold (G_APPLICATION (tecla_app));
+
+	instance->pooled = TRUE;
+	g_queue_push_head (&tecla_app->pool, instance);
+	gtk_application_remove_window (GTK_APPLICATION (tecla_app), window);
+
+	g_clear_handle_id (&tecla_app->pool_timeout_id, g_source_remove);
+	tecla_app->pool_timeout_id =
+		g_timeout_add_seconds (POOL_TIMEOUT_SECONDS,
+				       (GSourceFunc) pool_timeout_cb, tecla_app);
+}
+
+static TeclaInstance *
+take_pooled_instance (TeclaApplication *tecla_app,
+		      const gchar      *parent_handle)
+{
+	GList *l;
+
+	for (l = tecla_app->pool.head; l; l = l->next) {
+		TeclaInstance *instance = l->data;
+
+		/* The transient parent can not be unset on a reused window */
+		if (g_strcmp0 (instance->parent_handle, parent_handle) != 0)
+			continue;
+
+		g_queue_delete_link (&tecla_app->pool, l);
+		instance->pooled = FALSE;
+		gtk_application_add_window (GTK_APPLICATION (tecla_app),
+					    instance->window);
+
+		if (g_queue_is_empty (&tecla_app->pool)) {
+			g_clear_handle_id (&tecla_app->pool_timeout_id, g_source_remove);
+			g_application_release (G_APPLICATION (tecla_app));
+		}
+
+		return instance;
+	}
+
+	return NULL;
+}
+
+static TeclaInstance *
+create_instance (TeclaApplication *tecla_app,
+		 const gchar      *parent_handle)
+{
+	TeclaInstance *instance;
+
+	instance = g_new0 (TeclaInstance, 1);
+	instance->parent_handle = g_strdup (parent_handle);
+	create_window (tecla_app, instance);
+
+#ifdef GDK_WINDOWING_WAYLAND
+	if (parent_handle &&
+	    GDK_IS_WAYLAND_DISPLAY (gtk_widget_get_display (GTK_WIDGET (instance->window)))) {
+		GdkSurface *surface;
+
+		gtk_widget_realize (GTK_WIDGET (instance->window));
+		surface = gtk_native_get_surface (GTK_NATIVE (instance->window));
+		gdk_wayland_toplevel_set_transient_for_exported (GDK_TOPLEVEL (surface),
+								 parent_handle);
+	}
+#endif
+
+	/* Closing hides the window, so it can go to the pool */
+	gtk_window_set_hide_on_close (instance->window, TRUE);
+	g_signal_connect (instance->window, "notify::visible",
+			  G_CALLBACK (window_visible_notify_cb), instance);
+
+	instance->remove_handler_id =
+		g_signal_connect (tecla_app, "window-removed",
+				  G_CALLBACK (window_removed_cb),
+				  instance);
+
+	return instance;
 }
 
 void
@@ -410,9 +623,45 @@ main_window_removed_cb (TeclaApplication *tecla_app,
 	g_clear_object (&tecla_app->observer);
 	g_clear_object (&tecla_app->main.model);
 	tecla_app->main.view = NULL;
+	tecla_app->main.search = NULL;
 	tecla_app->main.window = NULL;
 }
 
+static void
+layout_model_ready_cb (GObject      *source_object,
+		       GAsyncResult *result,
+		       gpointer      user_data)
+{
+	TeclaInstance *instance = user_data;
+	TeclaApplication *tecla_app;
+	g_autoptr (TeclaModel) model = NULL;
+	g_autoptr (GError) error = NULL;
+
+	model = tecla_model_new_from_layout_name_finish (result, &error);
+
+	/* The instance may be gone already */
+	if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+		return;
+
+	tecla_app = TECLA_APPLICATION (g_application_get_default ());
+	if (tecla_app->pending == instance)
+		tecla_app->pending = NULL;
+
+	g_clear_object (&instance->cancellable);
+
+	if (!model) {
+		/* Rather than leaving an empty or stale window around */
+		g_warning ("%s", error->message);
+		destroy_instance (tecla_app, instance);
+		return;
+	}
+
+	g_set_object (&instance->model, model);
+	tecla_application_connect_model (instance->window,
+					 instance->view,
+					 instance->model);
+}
+
 static void
 tecla_application_activate (GApplication *app)
 {
@@ -422,8 +671,7 @@ tecla_application_activate (GApplication *app)
 
 	if (!layout) {
 		if (!tecla_app->main.window) {
-			tecla_app->main.window =
-				create_window (tecla_app, &tecla_app->main.view);
+			create_window (tecla_app, &tecla_app->main);
 			g_signal_connect (tecla_app, "window-removed",
 					  G_CALLBACK (main_window_removed_cb),
 					  NULL);
@@ -439,49 +687,57 @@ tecla_application_activate (GApplication *app)
 
 		gtk_window_present (tecla_app->main.window);
 	} else {
-		TeclaInstance *instance = g_new0 (TeclaInstance, 1);
-
-		instance->window = create_window (tecla_app, &instance->view);
-
-		instance->model =
-			tecla_model_new_from_layout_name (layout);
-
-		if (instance->model) {
-			connect_model (instance->window,
-				       instance->view,
-				       instance->model);
-			update_title (instance->window, instance->model);
+		TeclaInstance *instance = tecla_app->pending;
+
+		/* A window for another parent can not be reused, let its
+		 * compile finish and open a separate one.
+		 */
+		if (instance &&
+		    g_strcmp0 (instance->parent_handle, parent_handle) != 0)
+			instance = NULL;
+
+		if (instance) {
+			/* Supersede the layout still being compiled for this window */
+			g_cancellable_cancel (instance->cancellable);
+			g_clear_object (&instance->cancellable);
+		} else {
+			/* A pooled window only needs its model swapped */
+			instance = take_pooled_instance (tecla_app, parent_handle);
+			if (!instance)
+				instance = create_instance (tecla_app, parent_handle);
+
+			tecla_app->instances =
+				g_list_prepend (tecla_app->instances, instance);
 		}
 
-#ifdef GDK_WINDOWING_WAYLAND
-		if (parent_handle &&
-		    GDK_IS_WAYLAND_DISPLAY (gtk_widget_get_display (GTK_WIDGET (instance->window)))) {
-			GdkSurface *surface;
-
-			gtk_widget_realize (GTK_WIDGET (instance->window));
-			surface = gtk_native_get_surface (GTK_NATIVE (instance->window));
-			gdk_wayland_toplevel_set_transient_for_exported (GDK_TOPLEVEL (surface),
-									 parent_handle);
-		}
-#endif
-
-		instance->remove_handler_id =
-			g_signal_connect (tecla_app, "window-removed",
-					  G_CALLBACK (window_removed_cb),
-					  instance);
-
-		tecla_app->instances =
-			g_list_prepend (tecla_app->instances, instance);
+		/* Show the window right away, the view is filled in
+		 * once the keymap is compiled.
+		 */
+		instance->cancellable = g_cancellable_new ();
+		tecla_app->pending = instance;
+		tecla_model_new_from_layout_name_async (layout,
+							instance->cancellable,
+							layout_model_ready_cb,
+							instance);
 
 		gtk_window_present (instance->window);
 	}
 }
 
+static void
+tecla_application_shutdown (GApplication *app)
+{
+	clear_pool (TECLA_APPLICATION (app));
+
+	G_APPLICATION_CLASS (tecla_application_parent_class)->shutdown (app);
+}
+
 static void
 tecla_application_class_init (TeclaApplicationClass *klass)
 {
 	GApplicationClass *application_class = G_APPLICATION_CLASS (klass);
 
+	application_class->shutdown = tecla_application_shutdown;
 	application_class->command_line = tecla_application_command_line;
 	application_class->activate = tecla_application_activate;
 	application_class->handle_local_options = tecla_application_handle_local_options;
@@ -490,6 +746,7 @@ tecla_application_class_init (TeclaApplicationClass *klass)
 static void
 tecla_application_init (TeclaApplication *app)
 {
+	app->pool_size = DEFAULT_POOL_SIZE;
 	gtk_window_set_default_icon_name ("org.gnome.Tecla");
 	g_application_add_main_option_entries (G_APPLICATION (app), all_options);
 }
@@ -0,0 +1,525 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tecla-canvas.h"
+
+#include "tecla-key.h"
+#include "tecla-text-cache.h"
+
+/* Grid units, pixel sizes mirror the GtkGrid setup in tecla-view.ui */
+#define SPACING 6
+#define KEY_SIZE 48
+#define KEY_RADIUS 6
+#define KEY_PADDING 4
+
+typedef struct
+{
+	guint slot;
+	int left, top, width, height;
+	graphene_rect_t bounds;
+	GskRenderNode *node; /* legends at the current size */
+	gboolean node_valid;
+} CanvasRect;
+
+typedef struct
+{
+	const gchar *label; /* interned */
+	const gchar *label_altgr; /* interned */
+	TeclaTextLegend *legend;
+	TeclaTextLegend *legend_altgr;
+	guint8 state; /* TeclaCanvasKeyState */
+	gboolean pending; /* a legend is still being shaped */
+} CanvasKey;
+
+struct _TeclaCanvas
+{
+	GtkWidget parent_instance;
+	GArray *rects; /* CanvasRect, a key may span several */
+	GArray *keys; /* CanvasKey, indexed by slot */
+	int n_columns;
+	int n_rows;
+
+	/* What the cached legends were shaped and drawn with */
+	PangoFontDescription *font_desc;
+	GdkRGBA color;
+};
+
+enum
+{
+	KEY_ACTIVATED,
+	N_SIGNALS,
+};
+
+static guint signals[N_SIGNALS] = { 0, };
+
+G_DEFINE_TYPE (TeclaCanvas, tecla_canvas, GTK_TYPE_WIDGET)
+
+static void
+canvas_rect_clear (CanvasRect *rect)
+{
+	g_clear_pointer (&rect->node, gsk_render_node_unref);
+	rect->node_valid = FALSE;
+}
+
+static void
+canvas_key_clear (CanvasKey *key)
+{
+	g_clear_pointer (&key->legend, tecla_text_legend_unref);
+	g_clear_pointer (&key->legend_altgr, tecla_text_legend_unref);
+}
+
+static void
+invalidate_key_nodes (TeclaCanvas *canvas,
+		      guint        slot)
+{
+	guint i;
+
+	for (i = 0; i < canvas->rects->len; i++) {
+		CanvasRect *rect = &g_array_index (canvas->rects, CanvasRect, i);
+
+		if (rect->slot == slot)
+			canvas_rect_clear (rect);
+	}
+}
+
+static void
+invalidate_nodes (TeclaCanvas *canvas)
+{
+	guint i;
+
+	for (i = 0; i < canvas->rects->len; i++)
+		canvas_rect_clear (&g_array_index (canvas->rects, CanvasRect, i));
+}
+
+static void
+invalidate_legends (TeclaCanvas *canvas)
+{
+	guint i;
+
+	for (i = 0; i < canvas->keys->len; i++)
+		canvas_key_clear (&g_array_index (canvas->keys, CanvasKey, i));
+
+	invalidate_nodes (canvas);
+}
+
+static void
+tecla_canvas_finalize (GObject *object)
+{
+	TeclaCanvas *canvas = TECLA_CANVAS (object);
+
+	g_array_unref (canvas->rects);
+	g_array_unref (canvas->keys);
+	g_clear_pointer (&canvas->font_desc, pango_font_description_free);
+
+	G_OBJECT_CLASS (tecla_canvas_parent_class)->finalize (object);
+}
+
+static void
+tecla_canvas_measure (GtkWidget      *widget,
+		      GtkOrientation  orientation,
+		      int             for_size,
+		      int            *minimum,
+		      int            *natural,
+		      int            *minimum_baseline,
+		      int            *natural_baseline)
+{
+	TeclaCanvas *canvas = TECLA_CANVAS (widget);
+	int n_cells;
+
+	if (orientation == GTK_ORIENTATION_HORIZONTAL) {
+		/* Columns are quarter keys */
+		n_cells = canvas->n_columns;
+		*natural = n_cells * KEY_SIZE / 4;
+	} else {
+		n_cells = canvas->n_rows;
+		*natural = n_cells * KEY_SIZE;
+	}
+
+	*minimum = MAX (n_cells - 1, 0) * SPACING + n_cells;
+	*natural = MAX (*natural + MAX (n_cells - 1, 0) * SPACING, *minimum);
+}
+
+static void
+tecla_canvas_size_allocate (GtkWidget *widget,
+			    int        width,
+			    int        height,
+			    int        baseline)
+{
+	TeclaCanvas *canvas = TECLA_CANVAS (widget);
+	float column_width, row_height;
+	guint i;
+
+	if (canvas->n_columns == 0 || canvas->n_rows == 0)
+		return;
+
+	/* Same distribution as a homogeneous GtkGrid */
+	column_width = (float) (width - (canvas->n_columns - 1) * SPACING) / canvas->n_columns;
+	row_height = (float) (height - (canvas->n_rows - 1) * SPACING) / canvas->n_rows;
+
+	for (i = 0; i < canvas->rects->len; i++) {
+		CanvasRect *rect = &g_array_index (canvas->rects, CanvasRect, i);
+		graphene_size_t size = rect->bounds.size;
+
+		graphene_rect_init (&rect->bounds,
+				    rect->left * (column_width + SPACING),
+				    rect->top * (row_height + SPACING),
+				    rect->width * column_width + (rect->width - 1) * SPACING,
+				    rect->height * row_height + (rect->height - 1) * SPACING);
+
+		if (!graphene_size_equal (&size, &rect->bounds.size))
+			canvas_rect_clear (rect);
+	}
+}
+
+static void
+legend_ready_cb (GObject *object)
+{
+	TeclaCanvas *canvas = TECLA_CANVAS (object);
+	guint i;
+
+	for (i = 0; i < canvas->keys->len; i++) {
+		CanvasKey *key = &g_array_index (canvas->keys, CanvasKey, i);
+
+		if (key->pending) {
+			key->pending = FALSE;
+			invalidate_key_nodes (canvas, i);
+		}
+	}
+
+	gtk_widget_queue_draw (GTK_WIDGET (canvas));
+}
+
+static TeclaTextLegend *
+get_key_legend (TeclaCanvas *canvas,
+		CanvasKey   *key,
+		const gchar *label)
+{
+	GtkWidget *widget = GTK_WIDGET (canvas);
+	TeclaTextLegend *legend;
+
+	if (!label || label[0] == '\0')
+		return NULL;
+
+	/* Complex scripts are drawn once shaped off the main thread */
+	legend = tecla_text_cache_try_get_legend (gtk_widget_get_pango_context (widget),
+						  label,
+						  gtk_widget_get_scale_factor (widget),
+						  G_OBJECT (canvas),
+						  legend_ready_cb);
+	if (!legend)
+		key->pending = TRUE;
+
+	return legend;
+}
+
+static GskRenderNode *
+get_rect_node (TeclaCanvas *canvas,
+	       CanvasRect  *rect)
+{
+	CanvasKey *key = &g_array_index (canvas->keys, CanvasKey, rect->slot);
+
+	if (rect->node_valid)
+		return rect->node;
+
+	if (!key->legend)
+		key->legend = get_key_legend (canvas, key, key->label);
+	if (!key->legend_altgr)
+		key->legend_altgr = get_key_legend (canvas, key, key->label_altgr);
+
+	rect->node = tecla_key_render_legends (key->legend, key->legend_altgr,
+					       (int) rect->bounds.size.width - 2 * KEY_PADDING,
+					       (int) rect->bounds.size.height - 2 * KEY_PADDING,
+					       &canvas->color);
+	rect->node_valid = TRUE;
+
+	return rect->node;
+}
+
+static float
+get_key_alpha (guint8 state)
+{
+	/* Approximates the flat button backgrounds */
+	if ((state & TECLA_CANVAS_KEY_SELECTED) != 0)
+		return 0.35f;
+	else if ((state & TECLA_CANVAS_KEY_ACTIVE) != 0)
+		return 0.25f;
+
+	return 0.1f;
+}
+
+static void
+tecla_canvas_snapshot (GtkWidget   *widget,
+		       GtkSnapshot *snapshot)
+{
+	TeclaCanvas *canvas = TECLA_CANVAS (widget);
+	GdkRGBA color;
+	guint i;
+
+	gtk_widget_get_color (widget, &color);
+
+	for (i = 0; i < canvas->rects->len; i++) {
+		CanvasRect *rect = &g_array_index (canvas->rects, CanvasRect, i);
+		CanvasKey *key = &g_array_index (canvas->keys, CanvasKey, rect->slot);
+		GskRoundedRect outline;
+		GdkRGBA background = color;
+		GskRenderNode *node;
+
+		background.alpha *= get_key_alpha (key->state);
+		gsk_rounded_rect_init_from_rect (&outline, &rect->bounds, KEY_RADIUS);
+
+		gtk_snapshot_push_rounded_clip (snapshot, &outline);
+		gtk_snapshot_append_color (snapshot, &background, &rect->bounds);
+		gtk_snapshot_pop (snapshot);
+
+		if ((key->state & TECLA_CANVAS_KEY_HIGHLIGHTED) != 0) {
+			const float widths[4] = { 2, 2, 2, 2 };
+			const GdkRGBA colors[4] = { color, color, color, color };
+
+			gtk_snapshot_append_border (snapshot, &outline, widths, colors);
+		}
+
+		/* Legends are only shaped and recorded again on changes */
+		node = get_rect_node (canvas, rect);
+		if (!node)
+			continue;
+
+		gtk_snapshot_save (snapshot);
+		gtk_snapshot_translate (snapshot,
+					&GRAPHENE_POINT_INIT (rect->bounds.origin.x + KEY_PADDING,
+							      rect->bounds.origin.y + KEY_PADDING));
+		gtk_snapshot_append_node (snapshot, node);
+		gtk_snapshot_restore (snapshot);
+	}
+}
+
+static void
+tecla_canvas_css_changed (GtkWidget         *widget,
+			  GtkCssStyleChange *change)
+{
+	TeclaCanvas *canvas = TECLA_CANVAS (widget);
+	const PangoFontDescription *font_desc;
+	GdkRGBA color;
+
+	GTK_WIDGET_CLASS (tecla_canvas_parent_class)->css_changed (widget, change);
+
+	font_desc = pango_context_get_font_description (gtk_widget_get_pango_context (widget));
+	if (!canvas->font_desc ||
+	    !pango_font_description_equal (canvas->font_desc, font_desc)) {
+		g_clear_pointer (&canvas->font_desc, pango_font_description_free);
+		canvas->font_desc = pango_font_description_copy (font_desc);
+		invalidate_legends (canvas);
+	}
+
+	gtk_widget_get_color (widget, &color);
+	if (!gdk_rgba_equal (&canvas->color, &color)) {
+		canvas->color = color;
+		invalidate_nodes (canvas);
+	}
+}
+
+static void
+tecla_canvas_class_init (TeclaCanvasClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	GtkWidgetClass *widget_class = GTK_WIDGET_CLASS (klass);
+
+	object_class->finalize = tecla_canvas_finalize;
+
+	widget_class->measure = tecla_canvas_measure;
+	widget_class->size_allocate = tecla_canvas_size_allocate;
+	widget_class->snapshot = tecla_canvas_snapshot;
+	widget_class->css_changed = tecla_canvas_css_changed;
+
+	signals[KEY_ACTIVATED] =
+		g_signal_new ("key-activated",
+			      G_OBJECT_CLASS_TYPE (object_class),
+			      G_SIGNAL_RUN_LAST,
+			      0, NULL, NULL, NULL,
+			      G_TYPE_NONE,
+			      1, G_TYPE_UINT);
+
+	/* Shares the key styling loaded by TeclaKey */
+	g_type_class_unref (g_type_class_ref (TECLA_TYPE_KEY));
+
+	gtk_widget_class_set_css_name (widget_class, "tecla-canvas");
+}
+
+static gboolean
+find_key (TeclaCanvas *canvas,
+	  double       x,
+	  double       y,
+	  guint       *slot)
+{
+	guint i;
+
+	for (i = 0; i < canvas->rects->len; i++) {
+		CanvasRect *rect = &g_array_index (canvas->rects, CanvasRect, i);
+
+		if (graphene_rect_contains_point (&rect->bounds,
+						  &GRAPHENE_POINT_INIT (x, y))) {
+			*slot = rect->slot;
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+static void
+click_release_cb (GtkGestureClick *gesture,
+		  int              n_press,
+		  double           x,
+		  double           y,
+		  TeclaCanvas     *canvas)
+{
+	guint slot;
+
+	if (find_key (canvas, x, y, &slot))
+		g_signal_emit (canvas, signals[KEY_ACTIVATED], 0, slot);
+}
+
+static void
+scale_factor_notify_cb (TeclaCanvas *canvas,
+			GParamSpec  *pspec,
+			gpointer     user_data)
+{
+	invalidate_legends (canvas);
+	gtk_widget_queue_draw (GTK_WIDGET (canvas));
+}
+
+static void
+tecla_canvas_init (TeclaCanvas *canvas)
+{
+	GtkGesture *gesture;
+
+	canvas->rects = g_array_new (FALSE, FALSE, sizeof (CanvasRect));
+	g_array_set_clear_func (canvas->rects, (GDestroyNotify) canvas_rect_clear);
+	canvas->keys = g_array_new (FALSE, TRUE, sizeof (CanvasKey));
+	g_array_set_clear_func (canvas->keys, (GDestroyNotify) canvas_key_clear);
+
+	gesture = gtk_gesture_click_new ();
+	g_signal_connect (gesture, "released",
+			  G_CALLBACK (click_release_cb), canvas);
+	gtk_widget_add_controller (GTK_WIDGET (canvas),
+				   GTK_EVENT_CONTROLLER (gesture));
+
+	g_signal_connect (canvas, "notify::scale-factor",
+			  G_CALLBACK (scale_factor_notify_cb), NULL);
+}
+
+GtkWidget *
+tecla_canvas_new (void)
+{
+	return g_object_new (TECLA_TYPE_CANVAS, NULL);
+}
+
+void
+tecla_canvas_add_key (TeclaCanvas *canvas,
+		      guint        slot,
+		      int          left,
+		      int          top,
+		      int          width,
+		      int          height)
+{
+	CanvasRect rect = { 0, };
+
+	rect.slot = slot;
+	rect.left = left;
+	rect.top = top;
+	rect.width = width;
+	rect.height = height;
+	g_array_append_val (canvas->rects, rect);
+
+	if (slot >= canvas->keys->len)
+		g_array_set_size (canvas->keys, slot + 1);
+
+	canvas->n_columns = MAX (canvas->n_columns, left + width);
+	canvas->n_rows = MAX (canvas->n_rows, top + height);
+	gtk_widget_queue_resize (GTK_WIDGET (canvas));
+}
+
+void
+tecla_canvas_set_key_labels (TeclaCanvas *canvas,
+			     guint        slot,
+			     const gchar *label,
+			     const gchar *label_altgr)
+{
+	CanvasKey *key;
+
+	g_return_if_fail (slot < canvas->keys->len);
+
+	key = &g_array_index (canvas->keys, CanvasKey, slot);
+
+	/* Labels are interned, so they compare by pointer */
+	if (key->label == label && key->label_altgr == label_altgr)
+		return;
+
+	if (key->label != label) {
+		key->label = label;
+		g_clear_pointer (&key->legend, tecla_text_legend_unref);
+	}
+	if (key->label_altgr != label_altgr) {
+		key->label_altgr = label_altgr;
+		g_clear_pointer (&key->legend_altgr, tecla_text_legend_unref);
+	}
+
+	invalidate_key_nodes (canvas, slot);
+	gtk_widget_queue_draw (GTK_WIDGET (canvas));
+}
+
+void
+tecla_canvas_set_key_state (TeclaCanvas         *canvas,
+			    guint                slot,
+			    TeclaCanvasKeyState  state,
+			    gboolean             set)
+{
+	CanvasKey *key;
+	guint8 new_state;
+
+	g_return_if_fail (slot < canvas->keys->len);
+
+	key = &g_array_index (canvas->keys, CanvasKey, slot);
+	new_state = set ? key->state | state : key->state & ~state;
+
+	if (key->state == new_state)
+		return;
+
+	key->state = new_state;
+	gtk_widget_queue_draw (GTK_WIDGET (canvas));
+}
+
+gboolean
+tecla_canvas_get_key_bounds (TeclaCanvas     *canvas,
+			     guint            slot,
+			     graphene_rect_t *bounds)
+{
+	guint i;
+
+	for (i = 0; i < canvas->rects->len; i++) {
+		CanvasRect *rect = &g_array_index (canvas->rects, CanvasRect, i);
+
+		if (rect->slot == slot) {
+			*bounds = rect->bounds;
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
@@ -0,0 +1,56 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <gtk/gtk.h>
+
+#pragma once
+
+#define TECLA_TYPE_CANVAS (tecla_canvas_get_type ())
+G_DECLARE_FINAL_TYPE (TeclaCanvas, tecla_canvas, TECLA, CANVAS, GtkWidget)
+
+typedef enum
+{
+	TECLA_CANVAS_KEY_ACTIVE      = 1 << 0,
+	TECLA_CANVAS_KEY_SELECTED    = 1 << 1,
+	TECLA_CANVAS_KEY_HIGHLIGHTED = 1 << 2,
+} TeclaCanvasKeyState;
+
+GtkWidget * tecla_canvas_new (void);
+
+void tecla_canvas_add_key (TeclaCanvas *canvas,
+			   guint        slot,
+			   int          left,
+			   int          top,
+			   int          width,
+			   int          height);
+
+void tecla_canvas_set_key_labels (TeclaCanvas *canvas,
+				  guint        slot,
+				  const gchar *label,
+				  const gchar *label_altgr);
+
+void tecla_canvas_set_key_state (TeclaCanvas         *canvas,
+				 guint                slot,
+				 TeclaCanvasKeyState  state,
+				 gboolean             set);
+
+gboolean tecla_canvas_get_key_bounds (TeclaCanvas     *canvas,
+				      guint            slot,
+				      graphene_rect_t *bounds);
@@ -0,0 +1,202 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <glib.h>
+#include <stdlib.h>
+
+#include "tecla-label.h"
+#include "tecla-label-table.h"
+
+/* Generates tecla-label-table.c, an open-addressed hash table of every
+ * keysym defined in xkbcommon-keysyms.h mapped to its final key label.
+ */
+
+static void
+append_c_string (GString     *str,
+		 const gchar *text)
+{
+	const guchar *p;
+
+	g_string_append_c (str, '"');
+
+	/* Octal escapes are at most 3 digits long, so they can be
+	 * safely followed by anything else.
+	 */
+	for (p = (const guchar *) text; *p; p++) {
+		if (g_ascii_isalnum (*p) || *p == ' ')
+			g_string_append_c (str, *p);
+		else
+			g_string_append_printf (str, "\\%03o", *p);
+	}
+
+	g_string_append_c (str, '"');
+}
+
+static GArray *
+parse_keysyms (const gchar  *path,
+	       GError      **error)
+{
+	g_autoptr (GRegex) regex = NULL;
+	g_autoptr (GMatchInfo) match_info = NULL;
+	g_autoptr (GHashTable) seen = NULL;
+	g_autofree gchar *contents = NULL;
+	GArray *keysyms;
+
+	if (!g_file_get_contents (path, &contents, NULL, error))
+		return NULL;
+
+	regex = g_regex_new ("^#define\\s+XKB_KEY_\\w+\\s+0x([0-9a-fA-F]+)",
+			     G_REGEX_MULTILINE, 0, error);
+	if (!regex)
+		return NULL;
+
+	keysyms = g_array_new (FALSE, FALSE, sizeof (xkb_keysym_t));
+	seen = g_hash_table_new (NULL, NULL);
+
+	g_regex_match (regex, contents, 0, &match_info);
+
+	while (g_match_info_matches (match_info)) {
+		g_autofree gchar *hex = NULL;
+		xkb_keysym_t keysym;
+
+		hex = g_match_info_fetch (match_info, 1);
+		keysym = (xkb_keysym_t) g_ascii_strtoull (hex, NULL, 16);
+
+		if (keysym != XKB_KEY_NoSymbol &&
+		    g_hash_table_add (seen, GUINT_TO_POINTER (keysym)))
+			g_array_append_val (keysyms, keysym);
+
+		g_match_info_next (match_info, NULL);
+	}
+
+	return keysyms;
+}
+
+static int
+compare_keysyms (gconstpointer a,
+		 gconstpointer b)
+{
+	xkb_keysym_t ka = *(const xkb_keysym_t *) a;
+	xkb_keysym_t kb = *(const xkb_keysym_t *) b;
+
+	return (ka > kb) - (ka < kb);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+	g_autoptr (GArray) keysyms = NULL;
+	g_autoptr (GHashTable) label_ids = NULL;
+	g_autoptr (GString) out = NULL;
+	g_autoptr (GError) error = NULL;
+	g_autofree xkb_keysym_t *slots = NULL;
+	g_autofree guint *slot_labels = NULL;
+	g_autofree gchar **labels = NULL;
+	guint bits = 1, n_slots, n_labels = 0, i;
+
+	if (argc != 3) {
+		g_printerr ("Usage: %s xkbcommon-keysyms.h output.c\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	keysyms = parse_keysyms (argv[1], &error);
+	if (!keysyms) {
+		g_printerr ("Could not parse %s: %s\n", argv[1], error->message);
+		return EXIT_FAILURE;
+	}
+
+	g_array_sort (keysyms, compare_keysyms);
+
+	/* Keep the load factor under 50% so probe chains stay short */
+	while ((1u << bits) < keysyms->len * 2)
+		bits++;
+
+	n_slots = 1u << bits;
+	slots = g_new0 (xkb_keysym_t, n_slots);
+	slot_labels = g_new0 (guint, n_slots);
+	labels = g_new0 (gchar *, keysyms->len + 1);
+	label_ids = g_hash_table_new (g_str_hash, g_str_equal);
+
+	for (i = 0; i < keysyms->len; i++) {
+		xkb_keysym_t keysym = g_array_index (keysyms, xkb_keysym_t, i);
+		gchar *label = tecla_label_compute (keysym);
+		gpointer id;
+		guint slot;
+
+		/* Deduplicate labels, so equal labels share a pointer */
+		if (!g_hash_table_lookup_extended (label_ids, label, NULL, &id)) {
+			id = GUINT_TO_POINTER (n_labels);
+			labels[n_labels++] = label;
+			g_hash_table_insert (label_ids, label, id);
+		} else {
+			g_free (label);
+		}
+
+		slot = tecla_label_table_hash (keysym, bits);
+		while (slots[slot] != XKB_KEY_NoSymbol)
+			slot = (slot + 1) & (n_slots - 1);
+
+		slots[slot] = keysym;
+		slot_labels[slot] = GPOINTER_TO_UINT (id);
+	}
+
+	out = g_string_new ("/* Generated by tecla-gen-label-table, do not edit */\n\n"
+			    "#include \"tecla-label-table.h\"\n\n");
+
+	for (i = 0; i < n_labels; i++) {
+		g_string_append_printf (out, "static const gchar label_%u[] = ", i);
+		append_c_string (out, labels[i]);
+		g_string_append (out, ";\n");
+	}
+
+	g_string_append_printf (out,
+				"\nconst guint tecla_label_table_bits = %u;\n\n"
+				"const TeclaLabelEntry tecla_label_table[%u] = {\n",
+				bits, n_slots);
+
+	for (i = 0; i < n_slots; i++) {
+		if (slots[i] == XKB_KEY_NoSymbol)
+			continue;
+
+		g_string_append_printf (out, "\t[%u] = { 0x%x, label_%u },\n",
+					i, slots[i], slot_labels[i]);
+	}
+
+	g_string_append (out, "};\n\nconst xkb_keysym_t tecla_label_keysyms[] = {\n");
+
+	for (i = 0; i < keysyms->len; i++) {
+		g_string_append_printf (out, "\t0x%x,\n",
+					g_array_index (keysyms, xkb_keysym_t, i));
+	}
+
+	g_string_append_printf (out, "};\n\nconst gsize tecla_label_n_keysyms = %u;\n",
+				keysyms->len);
+
+	if (!g_file_set_contents (argv[2], out->str, out->len, &error)) {
+		g_printerr ("Could not write %s: %s\n", argv[2], error->message);
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < n_labels; i++)
+		g_free (labels[i]);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,231 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tecla-key-popover.h"
+
+#include "tecla-key.h"
+
+typedef struct
+{
+	GtkWidget *box;
+	GtkWidget *level;
+	GtkWidget *etching;
+	GtkWidget *desc;
+} LevelRow;
+
+struct _TeclaKeyPopover
+{
+	GtkPopover parent_instance;
+	GtkWidget *box;
+	GArray *rows; /* LevelRow, grown to the most levels shown so far */
+	const gchar *name; /* interned */
+	guint unparent_id;
+};
+
+G_DEFINE_TYPE (TeclaKeyPopover, tecla_key_popover, GTK_TYPE_POPOVER)
+
+static void
+tecla_key_popover_dispose (GObject *object)
+{
+	TeclaKeyPopover *popover = TECLA_KEY_POPOVER (object);
+
+	g_clear_handle_id (&popover->unparent_id, g_source_remove);
+
+	G_OBJECT_CLASS (tecla_key_popover_parent_class)->dispose (object);
+}
+
+static void
+tecla_key_popover_finalize (GObject *object)
+{
+	TeclaKeyPopover *popover = TECLA_KEY_POPOVER (object);
+
+	g_array_unref (popover->rows);
+
+	G_OBJECT_CLASS (tecla_key_popover_parent_class)->finalize (object);
+}
+
+static gboolean
+unparent_cb (TeclaKeyPopover *popover)
+{
+	popover->unparent_id = 0;
+	gtk_widget_unparent (GTK_WIDGET (popover));
+
+	return G_SOURCE_REMOVE;
+}
+
+static void
+tecla_key_popover_closed (GtkPopover *gtk_popover)
+{
+	TeclaKeyPopover *popover = TECLA_KEY_POPOVER (gtk_popover);
+	GtkWidget *parent;
+
+	parent = gtk_widget_get_parent (GTK_WIDGET (popover));
+
+	/* Keys may go away while hidden, do not stay attached to them */
+	if (parent && popover->unparent_id == 0) {
+		popover->unparent_id =
+			g_idle_add ((GSourceFunc) unparent_cb, popover);
+	}
+}
+
+static void
+tecla_key_popover_class_init (TeclaKeyPopoverClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	GtkPopoverClass *popover_class = GTK_POPOVER_CLASS (klass);
+
+	object_class->dispose = tecla_key_popover_dispose;
+	object_class->finalize = tecla_key_popover_finalize;
+
+	popover_class->closed = tecla_key_popover_closed;
+}
+
+/* Rows are relabeled for every key, and only added for keys with
+ * more levels than any shown before.
+ */
+static void
+ensure_rows (TeclaKeyPopover *popover,
+	     guint            n_rows)
+{
+	while (popover->rows->len < n_rows) {
+		LevelRow row;
+
+		row.box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 6);
+
+		row.level = gtk_label_new (NULL);
+		gtk_widget_add_css_class (row.level, "heading");
+		gtk_box_append (GTK_BOX (row.box), row.level);
+
+		row.etching = tecla_key_new (NULL);
+		gtk_widget_add_css_class (row.etching, "tecla-key");
+		gtk_widget_set_sensitive (row.etching, FALSE);
+		gtk_box_append (GTK_BOX (row.box), row.etching);
+
+		row.desc = gtk_label_new (NULL);
+		gtk_box_append (GTK_BOX (row.box), row.desc);
+
+		gtk_box_append (GTK_BOX (popover->box), row.box);
+		g_array_append_val (popover->rows, row);
+	}
+}
+
+static void
+tecla_key_popover_init (TeclaKeyPopover *popover)
+{
+	GtkWidget *box;
+
+	box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 6);
+	gtk_widget_set_margin_start (box, 12);
+	gtk_widget_set_margin_end (box, 12);
+	gtk_widget_set_margin_top (box, 12);
+	gtk_widget_set_margin_bottom (box, 12);
+
+	popover->box = box;
+	popover->rows = g_array_new (FALSE, FALSE, sizeof (LevelRow));
+
+	/* Enough for most layouts up front */
+	ensure_rows (popover, 4);
+
+	gtk_popover_set_child (GTK_POPOVER (popover), box);
+	gtk_popover_set_autohide (GTK_POPOVER (popover), FALSE);
+	gtk_popover_set_position (GTK_POPOVER (popover), GTK_POS_TOP);
+}
+
+GtkWidget *
+tecla_key_popover_new (void)
+{
+	return g_object_new (TECLA_TYPE_KEY_POPOVER, NULL);
+}
+
+/* Returns FALSE if the key has less than 2 levels to show */
+gboolean
+tecla_key_popover_set_key (TeclaKeyPopover *popover,
+			   TeclaModel      *model,
+			   int              group,
+			   const gchar     *name,
+			   int              n_levels)
+{
+	xkb_keycode_t keycode;
+	guint *keyvals;
+	int n_rows = 0, level;
+	guint i;
+
+	keycode = tecla_model_get_key_keycode (model, name);
+	keyvals = g_newa (guint, MAX (n_levels, 1));
+
+	for (level = 0; level < n_levels; level++) {
+		keyvals[level] = tecla_model_get_keyval (model, level, group, keycode);
+		if (keyvals[level] != 0)
+			n_rows++;
+	}
+
+	if (n_rows < 2)
+		return FALSE;
+
+	popover->name = g_intern_string (name);
+	ensure_rows (popover, n_rows);
+
+	for (level = 0, i = 0; level < n_levels; level++) {
+		LevelRow *row;
+		gchar str[4];
+
+		if (keyvals[level] == 0)
+			continue;
+
+		row = &g_array_index (popover->rows, LevelRow, i++);
+		g_snprintf (str, sizeof (str), "%d", level + 1);
+		gtk_label_set_text (GTK_LABEL (row->level), str);
+		tecla_key_set_label (TECLA_KEY (row->etching),
+				     tecla_model_lookup_key_label (model, level, group, name));
+		gtk_label_set_text (GTK_LABEL (row->desc),
+				    gdk_keyval_name (keyvals[level]));
+		gtk_widget_set_visible (row->box, TRUE);
+	}
+
+	for (; i < popover->rows->len; i++)
+		gtk_widget_set_visible (g_array_index (popover->rows, LevelRow, i).box, FALSE);
+
+	return TRUE;
+}
+
+const gchar *
+tecla_key_popover_get_key_name (TeclaKeyPopover *popover)
+{
+	return popover->name;
+}
+
+void
+tecla_key_popover_popup_at (TeclaKeyPopover    *popover,
+			    GtkWidget          *parent,
+			    const GdkRectangle *rect)
+{
+	GtkWidget *widget = GTK_WIDGET (popover);
+
+	g_clear_handle_id (&popover->unparent_id, g_source_remove);
+
+	if (gtk_widget_get_parent (widget) != parent) {
+		if (gtk_widget_get_parent (widget))
+			gtk_widget_unparent (widget);
+		gtk_widget_set_parent (widget, parent);
+	}
+
+	gtk_popover_set_pointing_to (GTK_POPOVER (popover), rect);
+	gtk_popover_popup (GTK_POPOVER (popover));
+}
@@ -0,0 +1,42 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <gtk/gtk.h>
+
+#include "tecla-model.h"
+
+#pragma once
+
+#define TECLA_TYPE_KEY_POPOVER (tecla_key_popover_get_type ())
+G_DECLARE_FINAL_TYPE (TeclaKeyPopover, tecla_key_popover, TECLA, KEY_POPOVER, GtkPopover)
+
+GtkWidget * tecla_key_popover_new (void);
+
+gboolean tecla_key_popover_set_key (TeclaKeyPopover *popover,
+				    TeclaModel      *model,
+				    int              group,
+				    const gchar     *name,
+				    int              n_levels);
+
+const gchar * tecla_key_popover_get_key_name (TeclaKeyPopover *popover);
+
+void tecla_key_popover_popup_at (TeclaKeyPopover    *popover,
+				 GtkWidget          *parent,
+				 const GdkRectangle *rect);
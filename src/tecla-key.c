@@ -22,12 +22,24 @@
 
 #include <math.h>
 
+#include "tecla-text-cache.h"
+
 struct _TeclaKey
 {
 	GtkWidget parent_class;
 	gchar *name;
-	gchar *label;
-	gchar *label_altgr; // Nueva etiqueta para AltGr
+	const gchar *label; /* interned */
+	const gchar *label_altgr; /* interned */
+
+	/* Legends, rebuilt on label, size or style changes */
+	TeclaTextLegend *legend;
+	TeclaTextLegend *legend_altgr;
+	PangoFontDescription *font_desc; /* the legends were shaped with */
+	GdkRGBA color;
+	GskRenderNode *node;
+	gboolean node_valid;
+	int node_width;
+	int node_height;
 };
 
 enum
@@ -88,7 +100,7 @@ tecla_key_set_property (GObject      *object,
 		break;
 	case PROP_LABEL:
 		tecla_key_set_label (TECLA_KEY (object),
-				     g_value_get_string (value));
+				     g_intern_string (g_value_get_string (value)));
 		break;
     // case PROP_LABEL_ALTGR: // Si se define como propiedad
 	//	tecla_key_set_label_altgr (TECLA_KEY (object),
@@ -105,35 +117,32 @@ tecla_key_finalize (GObject *object)
 	TeclaKey *key = TECLA_KEY (object);
 
 	g_free (key->name);
-	g_free (key->label);
-	g_free (key->label_altgr); // Liberar la nueva etiqueta
+	g_clear_pointer (&key->legend, tecla_text_legend_unref);
+	g_clear_pointer (&key->legend_altgr, tecla_text_legend_unref);
+	g_clear_pointer (&key->font_desc, pango_font_description_free);
+	g_clear_pointer (&key->node, gsk_render_node_unref);
 
 	G_OBJECT_CLASS (tecla_key_parent_class)->finalize (object);
 }
 
 static void
-tecla_key_snapshot (GtkWidget *widget,
-		    GtkSnapshot *snapshot)
+snapshot_legends (GtkSnapshot     *snapshot,
+		  TeclaTextLegend *legend_main,
+		  TeclaTextLegend *legend_altgr,
+		  int              width,
+		  int              height,
+		  const GdkRGBA   *color)
 {
-	TeclaKey *key = TECLA_KEY (widget);
-	PangoLayout *layout_main = NULL, *layout_altgr = NULL;
 	PangoRectangle rect_main, rect_altgr;
-	GdkRGBA color_main;
 	GdkRGBA color_altgr = {1, 0, 0, 1}; // Rojo para AltGr
-	int width, height;
 	float scale_main, scale_altgr;
 
-	width = gtk_widget_get_width (widget);
-	height = gtk_widget_get_height (widget);
-	gtk_widget_get_color (widget, &color_main);
-
 	// Etiqueta principal
-	if (key->label && key->label[0] != '\0') {
-		layout_main = gtk_widget_create_pango_layout (widget, key->label);
-		pango_layout_get_pixel_extents (layout_main, NULL, &rect_main);
+	if (legend_main) {
+		tecla_text_legend_get_pixel_extents (legend_main, &rect_main);
 		// Escalar para que quepa, intentando que no sea demasiado pequeño.
 		// Podríamos querer un tamaño de fuente ligeramente más pequeño si ambas etiquetas están presentes.
-        float height_ratio_main = (key->label_altgr && key->label_altgr[0] != '\0') ? 0.40f : 0.75f;
+        float height_ratio_main = legend_altgr ? 0.40f : 0.75f;
 		scale_main = MIN ((float) (height * height_ratio_main) / rect_main.height, 2.0f);
         scale_main = MAX (scale_main, 0.5f); // Evitar que sea demasiado pequeño
 		scale_main = roundf (scale_main * 4.0f) / 4.0f; // Ajustar a cuartos de píxel
@@ -142,7 +151,7 @@ tecla_key_snapshot (GtkWidget *widget,
         // Si hay etiqueta altgr, mover esta un poco hacia arriba, sino centrada
         int x_main = (width / 2) - ((rect_main.width / 2) * scale_main);
         int y_main;
-        if (key->label_altgr && key->label_altgr[0] != '\0') {
+        if (legend_altgr) {
              y_main = (height * 0.25f) - ((rect_main.height / 2) * scale_main) ; // Cuarto superior
         } else {
              y_main = (height / 2) - ((rect_main.height / 2) * scale_main); // Centrada
@@ -153,15 +162,13 @@ tecla_key_snapshot (GtkWidget *widget,
 		gtk_snapshot_save (snapshot);
 		gtk_snapshot_translate (snapshot, &GRAPHENE_POINT_INIT (x_main, y_main));
 		gtk_snapshot_scale (snapshot, scale_main, scale_main);
-		gtk_snapshot_append_layout (snapshot, layout_main, &color_main);
+		tecla_text_legend_snapshot (legend_main, snapshot, color);
 		gtk_snapshot_restore (snapshot);
-		g_object_unref (layout_main);
 	}
 
 	// Etiqueta AltGr (secundaria)
-	if (key->label_altgr && key->label_altgr[0] != '\0') {
-		layout_altgr = gtk_widget_create_pango_layout (widget, key->label_altgr);
-		pango_layout_get_pixel_extents (layout_altgr, NULL, &rect_altgr);
+	if (legend_altgr) {
+		tecla_text_legend_get_pixel_extents (legend_altgr, &rect_altgr);
         float height_ratio_altgr = 0.40f; // Darle un poco menos de espacio si la principal existe
 		scale_altgr = MIN ((float) (height * height_ratio_altgr) / rect_altgr.height, 2.0f);
         scale_altgr = MAX (scale_altgr, 0.5f);
@@ -175,9 +182,129 @@ tecla_key_snapshot (GtkWidget *widget,
 		gtk_snapshot_save (snapshot);
 		gtk_snapshot_translate (snapshot, &GRAPHENE_POINT_INIT (x_altgr, y_altgr));
 		gtk_snapshot_scale (snapshot, scale_altgr, scale_altgr);
-		gtk_snapshot_append_layout (snapshot, layout_altgr, &color_altgr);
+		tecla_text_legend_snapshot (legend_altgr, snapshot, &color_altgr);
 		gtk_snapshot_restore (snapshot);
-		g_object_unref (layout_altgr);
+	}
+}
+
+/* Also used by the canvas, which caches the node per key like we do */
+GskRenderNode *
+tecla_key_render_legends (TeclaTextLegend *legend,
+			  TeclaTextLegend *legend_altgr,
+			  int              width,
+			  int              height,
+			  const GdkRGBA   *color)
+{
+	GtkSnapshot *snapshot;
+
+	snapshot = gtk_snapshot_new ();
+	snapshot_legends (snapshot, legend, legend_altgr,
+			  width, height, color);
+
+	return gtk_snapshot_free_to_node (snapshot);
+}
+
+static void
+invalidate_node (TeclaKey *key)
+{
+	g_clear_pointer (&key->node, gsk_render_node_unref);
+	key->node_valid = FALSE;
+}
+
+static void
+invalidate_legends (TeclaKey *key)
+{
+	g_clear_pointer (&key->legend, tecla_text_legend_unref);
+	g_clear_pointer (&key->legend_altgr, tecla_text_legend_unref);
+	invalidate_node (key);
+}
+
+static void
+legend_ready_cb (GObject *object)
+{
+	TeclaKey *key = TECLA_KEY (object);
+
+	invalidate_node (key);
+	gtk_widget_queue_draw (GTK_WIDGET (key));
+}
+
+static TeclaTextLegend *
+get_key_legend (TeclaKey    *key,
+		const gchar *label)
+{
+	GtkWidget *widget = GTK_WIDGET (key);
+
+	if (!label || label[0] == '\0')
+		return NULL;
+
+	/* Complex scripts are drawn once shaped off the main thread */
+	return tecla_text_cache_try_get_legend (gtk_widget_get_pango_context (widget),
+						label,
+						gtk_widget_get_scale_factor (widget),
+						G_OBJECT (key),
+						legend_ready_cb);
+}
+
+static void
+tecla_key_snapshot (GtkWidget   *widget,
+		    GtkSnapshot *snapshot)
+{
+	TeclaKey *key = TECLA_KEY (widget);
+
+	if (!key->node_valid) {
+		if (!key->legend)
+			key->legend = get_key_legend (key, key->label);
+		if (!key->legend_altgr)
+			key->legend_altgr = get_key_legend (key, key->label_altgr);
+
+		key->node = tecla_key_render_legends (key->legend, key->legend_altgr,
+						      gtk_widget_get_width (widget),
+						      gtk_widget_get_height (widget),
+						      &key->color);
+		key->node_width = gtk_widget_get_width (widget);
+		key->node_height = gtk_widget_get_height (widget);
+		key->node_valid = TRUE;
+	}
+
+	if (key->node)
+		gtk_snapshot_append_node (snapshot, key->node);
+}
+
+static void
+tecla_key_size_allocate (GtkWidget *widget,
+			 int        width,
+			 int        height,
+			 int        baseline)
+{
+	TeclaKey *key = TECLA_KEY (widget);
+
+	if (key->node_width != width || key->node_height != height)
+		invalidate_node (key);
+}
+
+static void
+tecla_key_css_changed (GtkWidget         *widget,
+		       GtkCssStyleChange *change)
+{
+	TeclaKey *key = TECLA_KEY (widget);
+	const PangoFontDescription *font_desc;
+	GdkRGBA color;
+
+	GTK_WIDGET_CLASS (tecla_key_parent_class)->css_changed (widget, change);
+
+	/* State changes often leave color and font alone */
+	font_desc = pango_context_get_font_description (gtk_widget_get_pango_context (widget));
+	if (!key->font_desc ||
+	    !pango_font_description_equal (key->font_desc, font_desc)) {
+		g_clear_pointer (&key->font_desc, pango_font_description_free);
+		key->font_desc = pango_font_description_copy (font_desc);
+		invalidate_legends (key);
+	}
+
+	gtk_widget_get_color (widget, &color);
+	if (!gdk_rgba_equal (&key->color, &color)) {
+		key->color = color;
+		invalidate_node (key);
 	}
 }
 
@@ -194,6 +321,8 @@ tecla_key_class_init (TeclaKeyClass *klass)
 	object_class->finalize = tecla_key_finalize;
 
 	widget_class->snapshot = tecla_key_snapshot;
+	widget_class->size_allocate = tecla_key_size_allocate;
+	widget_class->css_changed = tecla_key_css_changed;
 
 	signals[ACTIVATED] =
 		g_signal_new ("activated",
@@ -243,6 +372,15 @@ click_release_cb (GtkGestureClick *gesture,
 	g_signal_emit (key, signals[ACTIVATED], 0);
 }
 
+static void
+scale_factor_notify_cb (TeclaKey   *key,
+			GParamSpec *pspec,
+			gpointer    user_data)
+{
+	invalidate_legends (key);
+	gtk_widget_queue_draw (GTK_WIDGET (key));
+}
+
 static void
 tecla_key_init (TeclaKey *key)
 {
@@ -255,6 +393,9 @@ tecla_key_init (TeclaKey *key)
 	gtk_widget_add_controller (GTK_WIDGET (key),
 				   GTK_EVENT_CONTROLLER (gesture));
 	gtk_widget_add_css_class (GTK_WIDGET (key), "opaque");
+
+	g_signal_connect (key, "notify::scale-factor",
+			  G_CALLBACK (scale_factor_notify_cb), NULL);
 }
 
 GtkWidget *
@@ -265,15 +406,17 @@ tecla_key_new (const gchar *name)
 			     NULL);
 }
 
+/* Labels are interned, so they compare by pointer */
 void
 tecla_key_set_label (TeclaKey    *key,
 		     const gchar *label)
 {
-	if (g_strcmp0 (label, key->label) == 0)
+	if (label == key->label)
 		return;
 
-	g_free (key->label);
-	key->label = g_strdup (label);
+	key->label = label;
+	g_clear_pointer (&key->legend, tecla_text_legend_unref);
+	invalidate_node (key);
 	gtk_widget_queue_draw (GTK_WIDGET (key));
 }
 
@@ -282,11 +425,12 @@ void
 tecla_key_set_label_altgr (TeclaKey    *key,
                            const gchar *label_altgr)
 {
-    if (g_strcmp0 (label_altgr, key->label_altgr) == 0)
+    if (label_altgr == key->label_altgr)
         return;
 
-    g_free (key->label_altgr);
-    key->label_altgr = g_strdup (label_altgr);
+    key->label_altgr = label_altgr;
+    g_clear_pointer (&key->legend_altgr, tecla_text_legend_unref);
+    invalidate_node (key);
     gtk_widget_queue_draw (GTK_WIDGET (key));
 }
 
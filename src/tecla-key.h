@@ -20,6 +20,8 @@
 
 #include <gtk/gtk.h>
 
+#include "tecla-text-cache.h"
+
 #pragma once
 
 #define TECLA_TYPE_KEY (tecla_key_get_type ())
@@ -35,3 +37,9 @@ void tecla_key_set_label_altgr (TeclaKey    *key,
                                 const gchar *label_altgr);
 
 const gchar * tecla_key_get_name (TeclaKey *key);
+
+GskRenderNode * tecla_key_render_legends (TeclaTextLegend *legend,
+					  TeclaTextLegend *legend_altgr,
+					  int              width,
+					  int              height,
+					  const GdkRGBA   *color);
@@ -0,0 +1,251 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "config.h"
+#include "tecla-keymap-cache.h"
+
+#include <errno.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+
+#include "tecla-util.h"
+
+static int cache_disabled = FALSE;
+static guint cache_hits = 0;
+static guint cache_misses = 0;
+static int cache_pruned = FALSE;
+
+static void
+append_mtime (GChecksum   *checksum,
+	      const gchar *dir)
+{
+	g_autofree gchar *str = NULL;
+
+	str = g_strdup_printf ("%s:%" G_GINT64_FORMAT ";", dir,
+			       tecla_util_get_xkb_dir_mtime (dir));
+	g_checksum_update (checksum, (const guchar *) str, -1);
+}
+
+static void
+append_string (GChecksum   *checksum,
+	       const gchar *str)
+{
+	if (str)
+		g_checksum_update (checksum, (const guchar *) str, -1);
+
+	/* Separator, so e.g. ("ab", "c") and ("a", "bc") differ */
+	g_checksum_update (checksum, (const guchar *) "", 1);
+}
+
+/* Entries are stored as <fingerprint>/<names>.xkb, where the
+ * fingerprint covers the tecla version and the xkb data directories.
+ * Whatever is outside the current fingerprint directory is stale.
+ */
+static gchar *
+get_cache_path (struct xkb_context           *xkb_context,
+		const struct xkb_rule_names *rule_names)
+{
+	g_autoptr (GChecksum) fingerprint = NULL;
+	g_autoptr (GChecksum) names = NULL;
+	g_autofree gchar *user_dir = NULL;
+	g_autofree gchar *filename = NULL;
+	unsigned int i;
+
+	fingerprint = g_checksum_new (G_CHECKSUM_SHA256);
+	append_string (fingerprint, PACKAGE_VERSION);
+
+	/* The user dir is only an include path if it exists, check it
+	 * separately so creating it also invalidates the cache.
+	 */
+	user_dir = tecla_util_get_user_xkb_dir ();
+	if (user_dir)
+		append_mtime (fingerprint, user_dir);
+
+	for (i = 0; i < xkb_context_num_include_paths (xkb_context); i++)
+		append_mtime (fingerprint, xkb_context_include_path_get (xkb_context, i));
+
+	names = g_checksum_new (G_CHECKSUM_SHA256);
+	append_string (names, rule_names->rules);
+	append_string (names, rule_names->model);
+	append_string (names, rule_names->layout);
+	append_string (names, rule_names->variant);
+	append_string (names, rule_names->options);
+
+	filename = g_strconcat (g_checksum_get_string (names), ".xkb", NULL);
+
+	return g_build_filename (g_get_user_cache_dir (), "tecla",
+				 g_checksum_get_string (fingerprint),
+				 filename, NULL);
+}
+
+static void
+remove_entry (const gchar *path)
+{
+	const gchar *name;
+	GDir *dir;
+
+	if (!g_file_test (path, G_FILE_TEST_IS_DIR) ||
+	    g_file_test (path, G_FILE_TEST_IS_SYMLINK)) {
+		g_unlink (path);
+		return;
+	}
+
+	dir = g_dir_open (path, 0, NULL);
+	if (dir) {
+		while ((name = g_dir_read_name (dir)) != NULL) {
+			g_autofree gchar *child = g_build_filename (path, name, NULL);
+
+			g_unlink (child);
+		}
+
+		g_dir_close (dir);
+	}
+
+	g_rmdir (path);
+}
+
+/* Drops every fingerprint directory but @current_dir, along with
+ * entries from before fingerprint directories.
+ */
+static void
+prune_stale_entries (const gchar *current_dir)
+{
+	g_autofree gchar *cache_dir = NULL;
+	g_autofree gchar *current = NULL;
+	const gchar *name;
+	GDir *dir;
+
+	cache_dir = g_path_get_dirname (current_dir);
+	current = g_path_get_basename (current_dir);
+
+	dir = g_dir_open (cache_dir, 0, NULL);
+	if (!dir)
+		return;
+
+	while ((name = g_dir_read_name (dir)) != NULL) {
+		g_autofree gchar *path = NULL;
+
+		if (g_str_equal (name, current))
+			continue;
+
+		path = g_build_filename (cache_dir, name, NULL);
+		g_debug ("Removing stale keymap cache entry %s", path);
+		remove_entry (path);
+	}
+
+	g_dir_close (dir);
+}
+
+static struct xkb_keymap *
+load_cached_keymap (struct xkb_context *xkb_context,
+		    const gchar        *path)
+{
+	g_autofree gchar *contents = NULL;
+	struct xkb_keymap *xkb_keymap;
+	gsize len;
+
+	if (!g_file_get_contents (path, &contents, &len, NULL))
+		return NULL;
+
+	xkb_keymap = xkb_keymap_new_from_buffer (xkb_context, contents, len,
+						 XKB_KEYMAP_FORMAT_TEXT_V1,
+						 XKB_KEYMAP_COMPILE_NO_FLAGS);
+	if (!xkb_keymap) {
+		g_warning ("Discarding invalid cached keymap %s", path);
+		g_unlink (path);
+	}
+
+	return xkb_keymap;
+}
+
+static void
+store_cached_keymap (struct xkb_keymap *xkb_keymap,
+		     const gchar       *path)
+{
+	g_autoptr (GError) error = NULL;
+	g_autofree gchar *dir = NULL;
+	char *str;
+
+	str = xkb_keymap_get_as_string (xkb_keymap, XKB_KEYMAP_FORMAT_TEXT_V1);
+	if (!str)
+		return;
+
+	dir = g_path_get_dirname (path);
+
+	if (g_mkdir_with_parents (dir, 0700) != 0 ||
+	    !g_file_set_contents (path, str, -1, &error)) {
+		g_debug ("Could not cache keymap to %s: %s", path,
+			 error ? error->message : g_strerror (errno));
+	} else if (g_atomic_int_compare_and_exchange (&cache_pruned, FALSE, TRUE)) {
+		/* Once per process, on the first miss */
+		prune_stale_entries (dir);
+	}
+
+	free (str);
+}
+
+struct xkb_keymap *
+tecla_keymap_cache_compile (struct xkb_context           *xkb_context,
+			    const struct xkb_rule_names *rule_names)
+{
+	g_autofree gchar *path = NULL;
+	struct xkb_keymap *xkb_keymap;
+
+	if (g_atomic_int_get (&cache_disabled))
+		return xkb_keymap_new_from_names (xkb_context, rule_names, 0);
+
+	path = get_cache_path (xkb_context, rule_names);
+	xkb_keymap = load_cached_keymap (xkb_context, path);
+
+	if (xkb_keymap) {
+		g_atomic_int_inc (&cache_hits);
+		g_debug ("Keymap cache hit for %s (%u hits, %u misses)", path,
+			 g_atomic_int_get (&cache_hits),
+			 g_atomic_int_get (&cache_misses));
+		return xkb_keymap;
+	}
+
+	g_atomic_int_inc (&cache_misses);
+	g_debug ("Keymap cache miss for %s (%u hits, %u misses)", path,
+		 g_atomic_int_get (&cache_hits),
+		 g_atomic_int_get (&cache_misses));
+
+	xkb_keymap = xkb_keymap_new_from_names (xkb_context, rule_names, 0);
+	if (xkb_keymap)
+		store_cached_keymap (xkb_keymap, path);
+
+	return xkb_keymap;
+}
+
+void
+tecla_keymap_cache_set_enabled (gboolean enabled)
+{
+	g_atomic_int_set (&cache_disabled, !enabled);
+}
+
+void
+tecla_keymap_cache_get_stats (guint *hits,
+			      guint *misses)
+{
+	if (hits)
+		*hits = g_atomic_int_get (&cache_hits);
+	if (misses)
+		*misses = g_atomic_int_get (&cache_misses);
+}
@@ -0,0 +1,32 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <glib.h>
+#include <xkbcommon/xkbcommon.h>
+
+#pragma once
+
+struct xkb_keymap * tecla_keymap_cache_compile (struct xkb_context           *xkb_context,
+						const struct xkb_rule_names *rule_names);
+
+void tecla_keymap_cache_set_enabled (gboolean enabled);
+
+void tecla_keymap_cache_get_stats (guint *hits,
+				   guint *misses);
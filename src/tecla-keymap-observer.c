@@ -21,6 +21,13 @@
 #include "tecla-keymap-observer.h"
 
 #include <gdk/gdk.h>
+#include <glib-unix.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #ifdef GDK_WINDOWING_WAYLAND
 #include <gdk/wayland/gdkwayland.h>
@@ -29,18 +36,66 @@
 
 #include "tecla-util.h"
 
+/* Recently seen keymaps, switching back to one needs no compiling */
+#define MAX_RECENT_KEYMAPS 4
+
+typedef struct
+{
+	gchar *digest;
+	struct xkb_keymap *xkb_keymap;
+	TeclaModel *model;
+} RecentKeymap;
+
+/* One per wl_seat, owned by the dispatch thread */
+typedef struct
+{
+	TeclaKeymapObserver *observer;
+	uint32_t id; /* registry name */
+	gchar *name;
+	struct wl_seat *wl_seat;
+	struct wl_keyboard *wl_keyboard;
+	RecentKeymap *keymap;
+	uint32_t group;
+} ObserverSeat;
+
+/* The main context copy of a seat */
+typedef struct
+{
+	uint32_t id;
+	gchar *name;
+	RecentKeymap *keymap;
+	uint32_t group;
+} SeatState;
+
+/* Handed from the dispatch thread to the main context */
+typedef struct
+{
+	uint32_t seat_id;
+	gchar *seat_name;
+	RecentKeymap *keymap;
+	uint32_t group;
+	gboolean removed;
+} ObserverUpdate;
+
 struct _TeclaKeymapObserver
 {
 	GObject parent_instance;
 #ifdef GDK_WINDOWING_WAYLAND
-	uint32_t seat_id;
+	/* Only touched by the dispatch thread while it runs */
+	struct wl_display *wl_display;
+	struct wl_event_queue *wl_queue;
 	struct wl_registry *wl_registry;
-	struct wl_seat *wl_seat;
-	struct wl_keyboard *wl_keyboard;
+	GList *seats; /* ObserverSeat */
+	GQueue recent; /* RecentKeymap, most recent first */
+
+	GThread *dispatch_thread;
+	int stop_fds[2];
 #endif
+	GAsyncQueue *updates; /* ObserverUpdate */
+	GSource *update_source;
 
-	struct xkb_keymap *xkb_keymap;
-	uint32_t group;
+	/* Main context state, the first seat is the primary one */
+	GPtrArray *seat_states; /* SeatState */
 };
 
 enum
@@ -53,10 +108,233 @@ enum
 
 static GParamSpec *props[N_PROPS] = { 0, };
 
+enum
+{
+	SEAT_CHANGED,
+	N_SIGNALS,
+};
+
+static guint signals[N_SIGNALS] = { 0, };
+
 G_DEFINE_TYPE (TeclaKeymapObserver, tecla_keymap_observer, G_TYPE_OBJECT)
 
+static void
+recent_keymap_clear (RecentKeymap *recent)
+{
+	g_free (recent->digest);
+	xkb_keymap_unref (recent->xkb_keymap);
+	g_object_unref (recent->model);
+}
+
+static void
+recent_keymap_unref (RecentKeymap *recent)
+{
+	g_atomic_rc_box_release_full (recent, (GDestroyNotify) recent_keymap_clear);
+}
+
+static void
+observer_update_free (ObserverUpdate *update)
+{
+	g_clear_pointer (&update->keymap, recent_keymap_unref);
+	g_free (update->seat_name);
+	g_free (update);
+}
+
+static void
+seat_state_free (SeatState *state)
+{
+	g_clear_pointer (&state->keymap, recent_keymap_unref);
+	g_free (state->name);
+	g_free (state);
+}
+
+static SeatState *
+find_seat_state (TeclaKeymapObserver *observer,
+		 uint32_t             id,
+		 const gchar         *name,
+		 guint               *index)
+{
+	guint i;
+
+	for (i = 0; i < observer->seat_states->len; i++) {
+		SeatState *state = g_ptr_array_index (observer->seat_states, i);
+
+		if ((name && g_strcmp0 (state->name, name) == 0) ||
+		    (!name && state->id == id)) {
+			if (index)
+				*index = i;
+			return state;
+		}
+	}
+
+	return NULL;
+}
+
+static void
+apply_update (TeclaKeymapObserver *observer,
+	      ObserverUpdate      *update)
+{
+	gboolean keymap_changed = FALSE, group_changed = FALSE, seat_changed = FALSE;
+	g_autofree gchar *name = NULL;
+	SeatState *state;
+	guint index;
+
+	state = find_seat_state (observer, update->seat_id, NULL, &index);
+
+	if (update->removed) {
+		if (!state)
+			return;
+
+		name = g_strdup (state->name);
+		g_ptr_array_remove_index (observer->seat_states, index);
+		g_signal_emit (observer, signals[SEAT_CHANGED], 0, name);
+
+		/* The next seat takes over as primary */
+		if (index == 0) {
+			g_object_notify (G_OBJECT (observer), "keymap");
+			g_object_notify (G_OBJECT (observer), "group");
+		}
+		return;
+	}
+
+	if (!state) {
+		state = g_new0 (SeatState, 1);
+		state->id = update->seat_id;
+		index = observer->seat_states->len;
+		g_ptr_array_add (observer->seat_states, state);
+		seat_changed = TRUE;
+	}
+
+	if (g_set_str (&state->name, update->seat_name))
+		seat_changed = TRUE;
+
+	if (update->keymap && update->keymap != state->keymap) {
+		g_clear_pointer (&state->keymap, recent_keymap_unref);
+		state->keymap = g_steal_pointer (&update->keymap);
+		keymap_changed = TRUE;
+	}
+
+	if (state->group != update->group) {
+		state->group = update->group;
+		group_changed = TRUE;
+	}
+
+	if (!seat_changed && !keymap_changed && !group_changed)
+		return;
+
+	g_signal_emit (observer, signals[SEAT_CHANGED], 0, state->name);
+
+	if (index == 0 && keymap_changed)
+		g_object_notify (G_OBJECT (observer), "keymap");
+	if (index == 0 && group_changed)
+		g_object_notify (G_OBJECT (observer), "group");
+}
+
+static gboolean
+update_source_dispatch (GSource     *source,
+			GSourceFunc  callback,
+			gpointer     user_data)
+{
+	TeclaKeymapObserver *observer = user_data;
+	ObserverUpdate *update;
+
+	g_source_set_ready_time (source, -1);
+
+	while ((update = g_async_queue_try_pop (observer->updates)) != NULL) {
+		apply_update (observer, update);
+		observer_update_free (update);
+	}
+
+	return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs update_source_funcs = {
+	NULL,
+	NULL,
+	update_source_dispatch,
+	NULL,
+};
+
 #ifdef GDK_WINDOWING_WAYLAND
 
+static RecentKeymap *
+recent_keymap_ref (RecentKeymap *recent)
+{
+	return g_atomic_rc_box_acquire (recent);
+}
+
+/* Seats with the same keymap share the compiled one */
+static RecentKeymap *
+find_shared_keymap (TeclaKeymapObserver *observer,
+		    const gchar         *digest)
+{
+	GList *l;
+
+	for (l = observer->recent.head; l; l = l->next) {
+		RecentKeymap *recent = l->data;
+
+		if (g_strcmp0 (recent->digest, digest) == 0)
+			return recent_keymap_ref (recent);
+	}
+
+	for (l = observer->seats; l; l = l->next) {
+		ObserverSeat *seat = l->data;
+
+		if (seat->keymap && g_strcmp0 (seat->keymap->digest, digest) == 0)
+			return recent_keymap_ref (seat->keymap);
+	}
+
+	return NULL;
+}
+
+static void
+remember_keymap (TeclaKeymapObserver *observer,
+		 RecentKeymap        *recent)
+{
+	GList *l;
+
+	l = g_queue_find (&observer->recent, recent);
+	if (l) {
+		g_queue_unlink (&observer->recent, l);
+		g_queue_push_head_link (&observer->recent, l);
+		return;
+	}
+
+	g_queue_push_head (&observer->recent, recent_keymap_ref (recent));
+
+	while (g_queue_get_length (&observer->recent) > MAX_RECENT_KEYMAPS)
+		recent_keymap_unref (g_queue_pop_tail (&observer->recent));
+}
+
+/* Called from the dispatch thread */
+static void
+push_update (ObserverSeat *seat,
+	     gboolean      removed)
+{
+	TeclaKeymapObserver *observer = seat->observer;
+	ObserverUpdate *update;
+
+	update = g_new0 (ObserverUpdate, 1);
+	update->seat_id = seat->id;
+	update->seat_name = g_strdup (seat->name);
+	update->keymap = seat->keymap ? recent_keymap_ref (seat->keymap) : NULL;
+	update->group = seat->group;
+	update->removed = removed;
+
+	g_async_queue_push (observer->updates, update);
+	g_source_set_ready_time (observer->update_source, 0);
+}
+
+static void
+observer_seat_free (ObserverSeat *seat)
+{
+	g_clear_pointer (&seat->wl_keyboard, wl_keyboard_destroy);
+	g_clear_pointer (&seat->wl_seat, wl_seat_destroy);
+	g_clear_pointer (&seat->keymap, recent_keymap_unref);
+	g_free (seat->name);
+	g_free (seat);
+}
+
 static void
 dummy (void)
 {
@@ -69,27 +347,76 @@ keyboard_keymap (void               *data,
 		 int32_t             fd,
 		 uint32_t            size)
 {
-	TeclaKeymapObserver *observer = data;
-	g_autoptr (GMappedFile) mapped_file = NULL;
+	ObserverSeat *seat = data;
+	TeclaKeymapObserver *observer = seat->observer;
+	g_autofree gchar *digest = NULL;
 	struct xkb_context *xkb_context;
+	struct xkb_keymap *xkb_keymap;
+	RecentKeymap *recent;
+	const gchar *map;
+	gsize length;
 
-	mapped_file = g_mapped_file_new_from_fd (fd, FALSE, NULL);
-	if (!mapped_file)
+	if (format != WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1 || size == 0) {
+		close (fd);
 		return;
+	}
 
-	if (observer->xkb_keymap)
-		xkb_keymap_unref (observer->xkb_keymap);
-
-	xkb_context = tecla_util_create_xkb_context ();
-	observer->xkb_keymap =
-		xkb_keymap_new_from_string (xkb_context,
-					    g_mapped_file_get_contents (mapped_file),
-					    format,
-					    XKB_KEYMAP_COMPILE_NO_FLAGS);
-	xkb_context_unref (xkb_context);
+	map = mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
 	close (fd);
+	if (map == MAP_FAILED)
+		return;
+
+	/* The size is explicit, the terminating nul is optional */
+	length = size;
+	if (map[length - 1] == '\0')
+		length--;
+
+	digest = g_compute_checksum_for_data (G_CHECKSUM_SHA256,
+					      (const guchar *) map, length);
+
+	/* Compositors resend the same keymap on focus and seat changes */
+	if (seat->keymap && g_strcmp0 (digest, seat->keymap->digest) == 0) {
+		munmap ((gpointer) map, size);
+		return;
+	}
+
+	recent = find_shared_keymap (observer, digest);
+	if (!recent) {
+		/* The main thread may drop the last keymap ref, and the context
+		 * with it, so don't use the per-thread one. Serialized keymaps
+		 * are self contained and need no include paths.
+		 */
+		xkb_context = xkb_context_new (XKB_CONTEXT_NO_DEFAULT_INCLUDES |
+					       XKB_CONTEXT_NO_ENVIRONMENT_NAMES);
+		if (!xkb_context) {
+			munmap ((gpointer) map, size);
+			return;
+		}
+
+		xkb_keymap = xkb_keymap_new_from_buffer (xkb_context, map, length,
+							 XKB_KEYMAP_FORMAT_TEXT_V1,
+							 XKB_KEYMAP_COMPILE_NO_FLAGS);
+		xkb_context_unref (xkb_context);
+
+		if (!xkb_keymap) {
+			munmap ((gpointer) map, size);
+			return;
+		}
+
+		/* The model is built here too, the main thread only picks it up */
+		recent = g_atomic_rc_box_new0 (RecentKeymap);
+		recent->digest = g_steal_pointer (&digest);
+		recent->xkb_keymap = xkb_keymap;
+		recent->model = tecla_model_new_from_xkb_keymap_digest (xkb_keymap,
+									recent->digest);
+	}
+
+	munmap ((gpointer) map, size);
 
-	g_object_notify (G_OBJECT (observer), "keymap");
+	g_clear_pointer (&seat->keymap, recent_keymap_unref);
+	seat->keymap = recent;
+	remember_keymap (observer, recent);
+	push_update (seat, FALSE);
 }
 
 static void
@@ -101,13 +428,13 @@ keyboard_modifiers (void               *data,
 		    uint32_t            mods_locked,
 		    uint32_t            group)
 {
-	TeclaKeymapObserver *observer = data;
+	ObserverSeat *seat = data;
 
-	if (observer->group == group)
+	if (seat->group == group)
 		return;
 
-	observer->group = group;
-	g_object_notify (G_OBJECT (observer), "group");
+	seat->group = group;
+	push_update (seat, FALSE);
 }
 
 static struct wl_keyboard_listener keyboard_listener = {
@@ -124,21 +451,35 @@ seat_capabilities (void           *data,
 		   struct wl_seat *wl_seat,
 		   uint32_t        capabilities)
 {
-	TeclaKeymapObserver *observer = data;
+	ObserverSeat *seat = data;
 
-	if (!observer->wl_keyboard &&
+	if (!seat->wl_keyboard &&
 	    (capabilities & WL_SEAT_CAPABILITY_KEYBOARD) != 0) {
-		observer->wl_keyboard = wl_seat_get_keyboard (wl_seat);
-		wl_keyboard_add_listener (observer->wl_keyboard, &keyboard_listener, observer);
-	} else if (observer->wl_keyboard &&
+		seat->wl_keyboard = wl_seat_get_keyboard (wl_seat);
+		wl_keyboard_add_listener (seat->wl_keyboard, &keyboard_listener, seat);
+	} else if (seat->wl_keyboard &&
 		   (capabilities & WL_SEAT_CAPABILITY_KEYBOARD) == 0) {
-		g_clear_pointer (&observer->wl_keyboard, wl_keyboard_destroy);
+		g_clear_pointer (&seat->wl_keyboard, wl_keyboard_destroy);
 	}
 }
 
+static void
+seat_name (void           *data,
+	   struct wl_seat *wl_seat,
+	   const char     *name)
+{
+	ObserverSeat *seat = data;
+
+	if (g_strcmp0 (seat->name, name) == 0)
+		return;
+
+	g_set_str (&seat->name, name);
+	push_update (seat, FALSE);
+}
+
 static struct wl_seat_listener seat_listener = {
 	seat_capabilities,
-	(void (*)(void *, struct wl_seat *, const char *)) dummy,
+	seat_name,
 };
 
 static void
@@ -149,15 +490,23 @@ registry_global (void               *data,
 		 uint32_t            version)
 {
 	TeclaKeymapObserver *observer = data;
+	ObserverSeat *seat;
 
 	if (strcmp (interface, "wl_seat") != 0)
 		return;
 
-	observer->wl_seat =
+	/* Named after the registry until wl_seat.name arrives */
+	seat = g_new0 (ObserverSeat, 1);
+	seat->observer = observer;
+	seat->id = name;
+	seat->name = g_strdup_printf ("seat-%u", name);
+	seat->wl_seat =
 		wl_registry_bind (wl_registry,
 				  name, &wl_seat_interface,
-				  1);
-	wl_seat_add_listener (observer->wl_seat, &seat_listener, observer);
+				  MIN (version, 2));
+	wl_seat_add_listener (seat->wl_seat, &seat_listener, seat);
+
+	observer->seats = g_list_append (observer->seats, seat);
 }
 
 static void
@@ -166,18 +515,121 @@ registry_global_remove (void               *data,
 			uint32_t            name)
 {
 	TeclaKeymapObserver *observer = data;
+	GList *l;
 
-	if (name != observer->seat_id)
-		return;
+	for (l = observer->seats; l; l = l->next) {
+		ObserverSeat *seat = l->data;
+
+		if (seat->id != name)
+			continue;
 
-	g_clear_pointer (&observer->wl_keyboard, wl_keyboard_destroy);
-	g_clear_pointer (&observer->wl_seat, wl_seat_destroy);
+		push_update (seat, TRUE);
+		observer->seats = g_list_delete_link (observer->seats, l);
+		observer_seat_free (seat);
+		break;
+	}
 }
 
 static struct wl_registry_listener registry_listener = {
 	registry_global,
 	registry_global_remove,
 };
+
+static gpointer
+dispatch_thread_func (TeclaKeymapObserver *observer)
+{
+	struct wl_display *wl_display = observer->wl_display;
+	struct pollfd fds[2] = {
+		{ wl_display_get_fd (wl_display), POLLIN, 0 },
+		{ observer->stop_fds[0], POLLIN, 0 },
+	};
+
+	/* Reads are coordinated with GDK through prepare_read() */
+	while (TRUE) {
+		while (wl_display_prepare_read_queue (wl_display, observer->wl_queue) != 0) {
+			if (wl_display_dispatch_queue_pending (wl_display, observer->wl_queue) < 0)
+				return NULL;
+		}
+
+		wl_display_flush (wl_display);
+
+		if (poll (fds, G_N_ELEMENTS (fds), -1) < 0) {
+			wl_display_cancel_read (wl_display);
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		if (fds[1].revents != 0) {
+			wl_display_cancel_read (wl_display);
+			break;
+		}
+
+		if ((fds[0].revents & POLLIN) != 0) {
+			if (wl_display_read_events (wl_display) < 0)
+				break;
+		} else {
+			wl_display_cancel_read (wl_display);
+			if ((fds[0].revents & (POLLERR | POLLHUP)) != 0)
+				break;
+		}
+
+		if (wl_display_dispatch_queue_pending (wl_display, observer->wl_queue) < 0)
+			break;
+	}
+
+	return NULL;
+}
+
+static void
+start_dispatch_thread (TeclaKeymapObserver *observer,
+		       struct wl_display   *wl_display)
+{
+	struct wl_display *wrapper;
+	g_autoptr (GError) error = NULL;
+
+	if (!g_unix_open_pipe (observer->stop_fds, FD_CLOEXEC, &error)) {
+		g_warning ("Could not create pipe: %s", error->message);
+		return;
+	}
+
+	/* Everything created from the registry ends up in the private queue */
+	observer->wl_display = wl_display;
+	observer->wl_queue = wl_display_create_queue (wl_display);
+	wrapper = wl_proxy_create_wrapper (wl_display);
+	wl_proxy_set_queue ((struct wl_proxy *) wrapper, observer->wl_queue);
+	observer->wl_registry = wl_display_get_registry (wrapper);
+	wl_proxy_wrapper_destroy (wrapper);
+
+	wl_registry_add_listener (observer->wl_registry,
+				  &registry_listener,
+				  observer);
+
+	observer->dispatch_thread =
+		g_thread_new ("tecla-keymap-observer",
+			      (GThreadFunc) dispatch_thread_func,
+			      observer);
+}
+
+static void
+stop_dispatch_thread (TeclaKeymapObserver *observer)
+{
+	if (!observer->dispatch_thread)
+		return;
+
+	if (write (observer->stop_fds[1], "x", 1) < 0)
+		g_warning ("Could not stop keymap thread: %s", g_strerror (errno));
+
+	g_thread_join (g_steal_pointer (&observer->dispatch_thread));
+	close (observer->stop_fds[0]);
+	close (observer->stop_fds[1]);
+
+	g_list_free_full (g_steal_pointer (&observer->seats),
+			  (GDestroyNotify) observer_seat_free);
+	g_clear_pointer (&observer->wl_registry, wl_registry_destroy);
+	g_clear_pointer (&observer->wl_queue, wl_event_queue_destroy);
+	g_queue_clear_full (&observer->recent, (GDestroyNotify) recent_keymap_unref);
+}
 #endif
 
 static void
@@ -185,13 +637,15 @@ tecla_keymap_observer_finalize (GObject *object)
 {
 	TeclaKeymapObserver *observer = TECLA_KEYMAP_OBSERVER (object);
 
+	/* No updates get pushed once the thread is gone */
 #ifdef GDK_WINDOWING_WAYLAND
-	g_clear_pointer (&observer->wl_keyboard, wl_keyboard_destroy);
-	g_clear_pointer (&observer->wl_seat, wl_seat_destroy);
-	g_clear_pointer (&observer->wl_registry, wl_registry_destroy);
+	stop_dispatch_thread (observer);
 #endif
 
-	g_clear_pointer (&observer->xkb_keymap, xkb_keymap_unref);
+	g_source_destroy (observer->update_source);
+	g_source_unref (observer->update_source);
+	g_async_queue_unref (observer->updates);
+	g_ptr_array_unref (observer->seat_states);
 
 	G_OBJECT_CLASS (tecla_keymap_observer_parent_class)->finalize (object);
 }
@@ -206,10 +660,10 @@ tecla_keymap_observer_get_property (GObject    *object,
 
 	switch (prop_id) {
 	case PROP_KEYMAP:
-		g_value_set_pointer (value, observer->xkb_keymap);
+		g_value_set_pointer (value, tecla_keymap_observer_get_keymap (observer));
 		break;
 	case PROP_GROUP:
-		g_value_set_int (value, observer->group);
+		g_value_set_int (value, tecla_keymap_observer_get_group (observer));
 		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
@@ -238,43 +692,152 @@ tecla_keymap_observer_class_init (TeclaKeymapObserverClass *klass)
 				  G_PARAM_READABLE);
 
 	g_object_class_install_properties (object_class, N_PROPS, props);
+
+	signals[SEAT_CHANGED] =
+		g_signal_new ("seat-changed",
+			      G_OBJECT_CLASS_TYPE (object_class),
+			      G_SIGNAL_RUN_LAST,
+			      0, NULL, NULL, NULL,
+			      G_TYPE_NONE, 1, G_TYPE_STRING);
 }
 
 static void
 tecla_keymap_observer_init (TeclaKeymapObserver *observer)
 {
+	observer->seat_states = g_ptr_array_new_with_free_func ((GDestroyNotify) seat_state_free);
+	observer->updates =
+		g_async_queue_new_full ((GDestroyNotify) observer_update_free);
+	observer->update_source = g_source_new (&update_source_funcs, sizeof (GSource));
+	g_source_set_callback (observer->update_source, NULL, observer, NULL);
+	g_source_set_name (observer->update_source, "[tecla] keymap observer");
+	g_source_attach (observer->update_source, NULL);
+}
+
+TeclaKeymapObserver *
+tecla_keymap_observer_new (void)
+{
+	TeclaKeymapObserver *observer;
 	GdkDisplay *display;
 
+	observer = g_object_new (TECLA_TYPE_KEYMAP_OBSERVER, NULL);
 	display = gdk_display_get_default ();
 
 #ifdef GDK_WINDOWING_WAYLAND
-	if (GDK_IS_WAYLAND_DISPLAY (display)) {
-		struct wl_display *wl_display;
-		struct wl_registry *wl_registry;
-
-		wl_display = gdk_wayland_display_get_wl_display (display);
-		wl_registry = wl_display_get_registry (wl_display);
-		wl_registry_add_listener (wl_registry,
-					  &registry_listener,
-					  observer);
-	}
+	if (GDK_IS_WAYLAND_DISPLAY (display))
+		start_dispatch_thread (observer, gdk_wayland_display_get_wl_display (display));
 #endif
+
+	return observer;
 }
 
+/* Observes a connection other than GDK's, e.g. a test compositor */
 TeclaKeymapObserver *
-tecla_keymap_observer_new (void)
+tecla_keymap_observer_new_for_wl_display (struct wl_display *wl_display)
+{
+	TeclaKeymapObserver *observer;
+
+	observer = g_object_new (TECLA_TYPE_KEYMAP_OBSERVER, NULL);
+
+#ifdef GDK_WINDOWING_WAYLAND
+	start_dispatch_thread (observer, wl_display);
+#endif
+
+	return observer;
+}
+
+static SeatState *
+get_primary_seat (TeclaKeymapObserver *observer)
 {
-	return g_object_new (TECLA_TYPE_KEYMAP_OBSERVER, NULL);
+	if (observer->seat_states->len == 0)
+		return NULL;
+
+	return g_ptr_array_index (observer->seat_states, 0);
 }
 
+/* Keymap of the primary seat */
 struct xkb_keymap *
 tecla_keymap_observer_get_keymap (TeclaKeymapObserver *observer)
 {
-	return observer->xkb_keymap;
+	SeatState *state = get_primary_seat (observer);
+
+	return state && state->keymap ? state->keymap->xkb_keymap : NULL;
+}
+
+/* SHA-256 of the keymap text, as sent by the compositor */
+const gchar *
+tecla_keymap_observer_get_digest (TeclaKeymapObserver *observer)
+{
+	SeatState *state = get_primary_seat (observer);
+
+	return state && state->keymap ? state->keymap->digest : NULL;
+}
+
+/* Built off the main thread along with the keymap */
+TeclaModel *
+tecla_keymap_observer_get_model (TeclaKeymapObserver *observer)
+{
+	SeatState *state = get_primary_seat (observer);
+
+	return state && state->keymap ? state->keymap->model : NULL;
 }
 
 int
 tecla_keymap_observer_get_group (TeclaKeymapObserver *observer)
 {
-	return observer->group;
+	SeatState *state = get_primary_seat (observer);
+
+	return state ? state->group : 0;
+}
+
+gchar **
+tecla_keymap_observer_get_seats (TeclaKeymapObserver *observer)
+{
+	GStrvBuilder *builder;
+	guint i;
+
+	builder = g_strv_builder_new ();
+
+	for (i = 0; i < observer->seat_states->len; i++) {
+		SeatState *state = g_ptr_array_index (observer->seat_states, i);
+
+		g_strv_builder_add (builder, state->name);
+	}
+
+	return g_strv_builder_unref_to_strv (builder);
+}
+
+TeclaModel *
+tecla_keymap_observer_get_seat_model (TeclaKeymapObserver *observer,
+				      const gchar         *seat)
+{
+	SeatState *state = find_seat_state (observer, 0, seat, NULL);
+
+	return state && state->keymap ? state->keymap->model : NULL;
+}
+
+struct xkb_keymap *
+tecla_keymap_observer_get_seat_keymap (TeclaKeymapObserver *observer,
+				       const gchar         *seat)
+{
+	SeatState *state = find_seat_state (observer, 0, seat, NULL);
+
+	return state && state->keymap ? state->keymap->xkb_keymap : NULL;
+}
+
+const gchar *
+tecla_keymap_observer_get_seat_digest (TeclaKeymapObserver *observer,
+				       const gchar         *seat)
+{
+	SeatState *state = find_seat_state (observer, 0, seat, NULL);
+
+	return state && state->keymap ? state->keymap->digest : NULL;
+}
+
+int
+tecla_keymap_observer_get_seat_group (TeclaKeymapObserver *observer,
+				      const gchar         *seat)
+{
+	SeatState *state = find_seat_state (observer, 0, seat, NULL);
+
+	return state ? state->group : 0;
 }
@@ -22,14 +22,38 @@
 
 #include <xkbcommon/xkbcommon.h>
 
+#include "tecla-model.h"
+
 #define TECLA_TYPE_KEYMAP_OBSERVER (tecla_keymap_observer_get_type ())
 G_DECLARE_FINAL_TYPE (TeclaKeymapObserver,
 		      tecla_keymap_observer,
 		      TECLA, KEYMAP_OBSERVER,
 		      GObject);
 
+struct wl_display;
+
 TeclaKeymapObserver * tecla_keymap_observer_new (void);
 
+TeclaKeymapObserver * tecla_keymap_observer_new_for_wl_display (struct wl_display *wl_display);
+
 struct xkb_keymap * tecla_keymap_observer_get_keymap (TeclaKeymapObserver *observer);
 
+const gchar * tecla_keymap_observer_get_digest (TeclaKeymapObserver *observer);
+
+TeclaModel * tecla_keymap_observer_get_model (TeclaKeymapObserver *observer);
+
 int tecla_keymap_observer_get_group (TeclaKeymapObserver *observer);
+
+gchar ** tecla_keymap_observer_get_seats (TeclaKeymapObserver *observer);
+
+struct xkb_keymap * tecla_keymap_observer_get_seat_keymap (TeclaKeymapObserver *observer,
+							   const gchar         *seat);
+
+const gchar * tecla_keymap_observer_get_seat_digest (TeclaKeymapObserver *observer,
+						    const gchar         *seat);
+
+TeclaModel * tecla_keymap_observer_get_seat_model (TeclaKeymapObserver *observer,
+						   const gchar         *seat);
+
+int tecla_keymap_observer_get_seat_group (TeclaKeymapObserver *observer,
+					  const gchar         *seat);
@@ -0,0 +1,65 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <glib.h>
+#include <xkbcommon/xkbcommon.h>
+
+#pragma once
+
+/* The table itself is generated at build time by tecla-gen-label-table
+ * from xkbcommon-keysyms.h, see src/meson.build.
+ */
+
+typedef struct _TeclaLabelEntry TeclaLabelEntry;
+
+struct _TeclaLabelEntry
+{
+	xkb_keysym_t keysym;
+	const gchar *label;
+};
+
+extern const TeclaLabelEntry tecla_label_table[];
+extern const guint tecla_label_table_bits;
+
+extern const xkb_keysym_t tecla_label_keysyms[];
+extern const gsize tecla_label_n_keysyms;
+
+static inline guint
+tecla_label_table_hash (xkb_keysym_t keysym,
+			guint        bits)
+{
+	return (guint) ((keysym * 2654435761u) >> (32 - bits));
+}
+
+static inline const gchar *
+tecla_label_table_lookup (xkb_keysym_t keysym)
+{
+	guint mask = (1u << tecla_label_table_bits) - 1;
+	guint slot = tecla_label_table_hash (keysym, tecla_label_table_bits);
+
+	while (tecla_label_table[slot].keysym != XKB_KEY_NoSymbol) {
+		if (tecla_label_table[slot].keysym == keysym)
+			return tecla_label_table[slot].label;
+
+		slot = (slot + 1) & mask;
+	}
+
+	return NULL;
+}
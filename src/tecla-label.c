@@ -0,0 +1,360 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tecla-label.h"
+
+#include <gtk/gtk.h>
+
+static struct {
+        gunichar ch;
+        const char *nick;
+} notable_chars[] = {
+        { 0x00a, "⍽"      }, /* NO-BREAK SPACE */
+        { 0x00ad, "SHY"   }, /* SOFT HYPHEN */
+        { 0x034f, "CGJ"   }, /* COMBINING GRAPHEME JOINER */
+        { 0x061c, "ALM"   }, /* ARABIC LETTER MARK */
+        { 0x200b, "ZWS"   }, /* ZERO WIDTH SPACE */
+        { 0x200c, "ZWNJ"  }, /* ZERO WIDTH NON-JOINER */
+        { 0x200d, "ZWJ"   }, /* ZERO WIDTH JOINER */
+        { 0x200e, "LRM"   }, /* LEFT-TO-RIGHT MARK */
+        { 0x200f, "RLM"   }, /* RIGHT-TO-LEFT MARK */
+        { 0x2028, "LS"    }, /* LINE SEPARATOR */
+        { 0x2029, "PS"    }, /* PARAGRAPH SEPARATOR */
+        { 0x202a, "LRE"   }, /* LEFT-TO-RIGHT EMBEDDING */
+        { 0x202b, "RLE"   }, /* RIGHT-TO-LEFT EMBEDDING */
+        { 0x202c, "PDF"   }, /* POP DIRECTIONAL FORMATTING */
+        { 0x202d, "LRO"   }, /* LEFT-TO-RIGHT OVERRIDE */
+        { 0x202e, "RLO"   }, /* RIGHT-TO-LEFT OVERRIDE */
+        { 0x202f, "⍽"     }, /* NARROW NO-BREAK SPACE */
+        { 0x2060, "WJ"    }, /* WORD JOINER */
+        { 0x2061, "FA"    }, /* FUNCTION APPLICATION */
+        { 0x2062, "IT"    }, /* INVISIBLE TIMES */
+        { 0x2063, "IS"    }, /* INVISIBLE SEPARATOR */
+        { 0x2066, "LRI"   }, /* LEFT-TO-RIGHT ISOLATE */
+        { 0x2067, "RLI"   }, /* RIGHT-TO-LEFT ISOLATE */
+        { 0x2068, "FSI"   }, /* FIRST STRONG ISOLATE */
+        { 0x2069, "PDI"   }, /* POP DIRECTIONAL ISOLATE */
+        { 0xfeff, "ZWNBS" }, /* ZERO WIDTH NO-BREAK SPACE */
+};
+
+static const gchar *
+get_unicode_nick (gunichar ch)
+{
+        for (gsize i = 0; i < G_N_ELEMENTS (notable_chars); i++) {
+                if (ch < notable_chars[i].ch)
+                        return NULL;
+
+                if (ch == notable_chars[i].ch)
+                        return notable_chars[i].nick;
+        }
+
+        return NULL;
+}
+
+gchar *
+tecla_label_compute (xkb_keysym_t key)
+{
+	const gchar *label = NULL;
+	gchar buf[5];
+	gunichar uc;
+
+	switch (key) {
+	case GDK_KEY_Mode_switch:
+	case GDK_KEY_ISO_Level3_Shift:
+		label = "";
+		break;
+
+	case GDK_KEY_Delete:
+		label = "⌦";
+		break;
+
+	case GDK_KEY_BackSpace:
+		label = "⌫";
+		break;
+
+	case GDK_KEY_space:
+		label = "";
+		break;
+
+	case GDK_KEY_dead_grave:
+		label = "◌̀";
+		break;
+
+	case GDK_KEY_dead_abovecomma:
+		label = "̓◌̓";
+		break;
+
+	case GDK_KEY_dead_abovereversedcomma:
+		label = "̔◌̔";
+		break;
+
+	case GDK_KEY_dead_acute:
+		label = "◌́";
+		break;
+
+	case GDK_KEY_dead_circumflex:
+		label = "◌̂";
+		break;
+
+	case GDK_KEY_dead_tilde:
+		label = "◌̃";
+		break;
+
+	case GDK_KEY_dead_macron:
+		label = "◌̄";
+		break;
+
+	case GDK_KEY_dead_breve:
+		label = "◌̆";
+		break;
+
+	case GDK_KEY_dead_abovedot:
+		label = "◌̇";
+		break;
+
+	case GDK_KEY_dead_diaeresis:
+		label = "◌̈";
+		break;
+
+	case GDK_KEY_dead_abovering:
+		label = "◌̊";
+		break;
+
+	case GDK_KEY_dead_doubleacute:
+		label = "◌̋";
+		break;
+
+	case GDK_KEY_dead_caron:
+		label = "◌̌";
+		break;
+
+	case GDK_KEY_dead_cedilla:
+		label = "◌̧";
+		break;
+
+	case GDK_KEY_dead_ogonek:
+		label = "◌̨";
+		break;
+
+	case GDK_KEY_dead_belowdot:
+		label = "◌̣";
+		break;
+
+	case GDK_KEY_dead_hook:
+		label = "◌̉";
+		break;
+
+	case GDK_KEY_dead_horn:
+		label = "◌̛";
+		break;
+
+	case GDK_KEY_dead_stroke:
+		label = "◌̵ ";
+		break;
+
+	case GDK_KEY_dead_hamza:
+		label = "ء";
+		break;
+
+	case GDK_KEY_horizconnector:
+		label = "";
+		break;
+
+	case GDK_KEY_dead_belowcomma:
+		label = "◌̦";
+		break;
+
+	case GDK_KEY_dead_iota:
+		label = "◌ͅ";
+		break;
+
+	case GDK_KEY_dead_doublegrave:
+		label = "◌̏";
+		break;
+
+	case GDK_KEY_dead_belowring:
+		label = "◌̥";
+		break;
+
+	case GDK_KEY_dead_belowmacron:
+		label = "◌̱";
+		break;
+
+	case GDK_KEY_dead_belowcircumflex:
+		label = "◌̭";
+		break;
+
+	case GDK_KEY_dead_belowtilde:
+		label = "◌̰";
+		break;
+
+	case GDK_KEY_dead_belowbreve:
+		label = "◌̮";
+		break;
+
+	case GDK_KEY_dead_belowdiaeresis:
+		label = "◌̤";
+		break;
+
+	case GDK_KEY_dead_lowline:
+		label = "◌̲";
+		break;
+
+	case GDK_KEY_dead_aboveverticalline:
+		label = "◌̍ ";
+		break;
+
+	case GDK_KEY_dead_belowverticalline:
+		label = "◌̩";
+		break;
+
+	case GDK_KEY_dead_longsolidusoverlay:
+		label = "◌̸ ";
+		break;
+
+	case GDK_KEY_dead_voiced_sound:
+		label = "◌゙";
+		break;
+
+	case GDK_KEY_dead_a:
+		label = "◌ͣ";
+		break;
+
+	case GDK_KEY_dead_e:
+		label = "◌ͤ";
+		break;
+
+	case GDK_KEY_dead_i:
+		label = "◌ͥ";
+		break;
+
+	case GDK_KEY_dead_o:
+		label = "◌ͦ";
+		break;
+
+	case GDK_KEY_dead_u:
+		label = "◌ͧ";
+		break;
+
+	case GDK_KEY_dead_small_schwa:
+		label = "◌ᷪ";
+		break;
+
+	case GDK_KEY_dead_greek:
+		label = "a→α";
+		break;
+
+	case GDK_KEY_dead_currency:
+		label = "e→€";
+		break;
+
+	case GDK_KEY_Multi_key:
+		label = "";
+		break;
+
+	case GDK_KEY_ISO_Enter:
+	case GDK_KEY_Return:
+		label = "⏎";
+		break;
+
+	case GDK_KEY_Shift_L:
+	case GDK_KEY_Shift_R:
+		label = "";
+		break;
+
+	case GDK_KEY_Caps_Lock:
+		label = "";
+		break;
+
+	case GDK_KEY_Tab:
+	case GDK_KEY_ISO_Left_Tab:
+		label = "⭾";
+		break;
+
+	case GDK_KEY_Alt_L:
+	case GDK_KEY_Alt_R:
+		label = "";
+		break;
+
+	case GDK_KEY_Super_L:
+	case GDK_KEY_Super_R:
+		label = "";
+		break;
+
+	case GDK_KEY_Control_L:
+	case GDK_KEY_Control_R:
+		label = "";
+		break;
+
+	case GDK_KEY_Meta_L:
+	case GDK_KEY_Meta_R:
+		label = "";
+		break;
+
+	case GDK_KEY_Menu:
+		label = "";
+		break;
+
+	case GDK_KEY_VoidSymbol:
+		label = "";
+		break;
+
+	case GDK_KEY_nobreakspace:
+		label = "";
+		break;
+
+	default:
+		uc = gdk_keyval_to_unicode (key);
+
+		if (uc != 0 && g_unichar_isgraph (uc)) {
+			buf[g_unichar_to_utf8 (uc, buf)] = '\0';
+			return g_strdup (buf);
+		} else {
+                        const gchar *nick = get_unicode_nick (uc);
+			const gchar *name = gdk_keyval_name (key);
+
+                        if (nick) {
+                                label = nick;
+                        }
+			else if (name) {
+				g_autofree gchar *fixed_name = NULL;
+				gchar *p;
+
+				fixed_name = g_strdup (name);
+
+				/* Replace underscores with spaces */
+				for (p = fixed_name; *p; p++)
+					if (*p == '_')
+						*p = ' ';
+				/* Get rid of scary ISO_ prefix */
+				if (g_strstr_len (fixed_name, -1, "ISO "))
+					return g_strdup (fixed_name + 4);
+				else
+					return g_strdup (fixed_name);
+			} else {
+				return g_strdup ("");
+			}
+		}
+
+		break;
+	}
+
+	return g_strdup (label);
+}
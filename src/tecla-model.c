@@ -20,50 +20,174 @@
 
 #include "tecla-model.h"
 
+#include <string.h>
+
+#include "ansi104.h"
+#include "tecla-keymap-cache.h"
+#include "tecla-label.h"
+#include "tecla-label-table.h"
 #include "tecla-util.h"
 
+typedef struct
+{
+	guint offset;
+	guint n_positions;
+} PositionRange;
+
+typedef struct
+{
+	GHashTable *ranges; /* guint32 → PositionRange index + 1 */
+	GArray *range_array; /* PositionRange */
+	GArray *positions; /* TeclaKeyPosition */
+} ReverseIndex;
+
+typedef struct
+{
+	guint32 key;
+	TeclaKeyPosition position;
+} IndexEntry;
+
 struct _TeclaModel
 {
 	GObject parent_instance;
-	struct xkb_keymap *xkb_keymap;
-	int group;
+	xkb_keycode_t min_keycode;
+	xkb_keycode_t max_keycode;
+	int n_groups;
+	int n_levels;
+	xkb_keysym_t *keysyms; /* keycode × group × level */
+	const gchar **labels; /* same layout as keysyms */
+	const gchar **key_names; /* interned, indexed by keycode */
+	GHashTable *keycodes_by_name;
+	gchar **group_names;
+	ReverseIndex keysym_positions;
+	ReverseIndex char_positions;
+	GArray *codepoints; /* gunichar, sorted, from all labels */
+	gchar *registry_key;
 };
 
-enum
+/* Models are immutable, so equal keymaps share one */
+G_LOCK_DEFINE_STATIC (registry);
+static GHashTable *registry = NULL; /* key → GWeakRef* of TeclaModel */
+
+G_DEFINE_TYPE (TeclaModel, tecla_model, G_TYPE_OBJECT)
+
+static void
+weak_ref_free (GWeakRef *ref)
 {
-	PROP_0,
-	PROP_NAME,
-	N_PROPS
-};
+	g_weak_ref_clear (ref);
+	g_free (ref);
+}
 
-static GParamSpec *props[N_PROPS] = { 0, };
+static TeclaModel *
+registry_lookup (const gchar *key)
+{
+	TeclaModel *model = NULL;
+	GWeakRef *ref;
+
+	G_LOCK (registry);
+
+	if (registry) {
+		ref = g_hash_table_lookup (registry, key);
+		if (ref)
+			model = g_weak_ref_get (ref);
+	}
+
+	G_UNLOCK (registry);
+
+	return model;
+}
 
-enum
+/* Takes the model, returns the one registered first if other
+ * thread compiled the same keymap meanwhile.
+ */
+static TeclaModel *
+registry_insert (const gchar *key,
+		 TeclaModel  *model)
 {
-	CHANGED,
-	N_SIGNALS,
-};
+	TeclaModel *existing = NULL;
+	GWeakRef *ref;
 
-static guint signals[N_SIGNALS] = { 0, };
+	G_LOCK (registry);
 
-G_DEFINE_TYPE (TeclaModel, tecla_model, G_TYPE_OBJECT)
+	if (!registry) {
+		registry = g_hash_table_new_full (g_str_hash, g_str_equal,
+						  g_free, (GDestroyNotify) weak_ref_free);
+	}
+
+	ref = g_hash_table_lookup (registry, key);
+	if (ref)
+		existing = g_weak_ref_get (ref);
+
+	if (!existing) {
+		if (!ref) {
+			ref = g_new0 (GWeakRef, 1);
+			g_weak_ref_init (ref, NULL);
+			g_hash_table_insert (registry, g_strdup (key), ref);
+		}
+
+		g_weak_ref_set (ref, model);
+		model->registry_key = g_strdup (key);
+	}
+
+	G_UNLOCK (registry);
+
+	if (existing) {
+		g_object_unref (model);
+		return existing;
+	}
+
+	return model;
+}
 
 static void
-tecla_model_get_property (GObject    *object,
-			  guint       prop_id,
-			  GValue     *value,
-			  GParamSpec *pspec)
+registry_remove (TeclaModel *model)
+{
+	TeclaModel *other = NULL;
+	GWeakRef *ref;
+
+	G_LOCK (registry);
+
+	/* The key may have been taken over by a newer model */
+	ref = g_hash_table_lookup (registry, model->registry_key);
+	if (ref) {
+		other = g_weak_ref_get (ref);
+		if (!other)
+			g_hash_table_remove (registry, model->registry_key);
+	}
+
+	G_UNLOCK (registry);
+
+	g_clear_object (&other);
+}
+
+static void
+clear_reverse_index (ReverseIndex *reverse)
+{
+	g_clear_pointer (&reverse->ranges, g_hash_table_unref);
+	g_clear_pointer (&reverse->range_array, g_array_unref);
+	g_clear_pointer (&reverse->positions, g_array_unref);
+}
+
+static void
+tecla_model_finalize (GObject *object)
 {
 	TeclaModel *model = TECLA_MODEL (object);
 
-	switch (prop_id) {
-	case PROP_NAME:
-		g_value_set_string (value, tecla_model_get_name (model));
-		break;
-	default:
-		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
-		break;
+	g_free (model->keysyms);
+	g_free (model->labels);
+	g_free (model->key_names);
+	g_clear_pointer (&model->keycodes_by_name, g_hash_table_unref);
+	g_strfreev (model->group_names);
+	clear_reverse_index (&model->keysym_positions);
+	clear_reverse_index (&model->char_positions);
+	g_clear_pointer (&model->codepoints, g_array_unref);
+
+	if (model->registry_key) {
+		registry_remove (model);
+		g_free (model->registry_key);
 	}
+
+	G_OBJECT_CLASS (tecla_model_parent_class)->finalize (object);
 }
 
 static void
@@ -71,378 +195,471 @@ tecla_model_class_init (TeclaModelClass *klass)
 {
 	GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
-	object_class->get_property = tecla_model_get_property;
+	object_class->finalize = tecla_model_finalize;
+}
+
+static void
+tecla_model_init (TeclaModel *model)
+{
+	model->keycodes_by_name = g_hash_table_new (g_str_hash, g_str_equal);
+}
+
+static inline gsize
+keysym_index (TeclaModel    *model,
+	      xkb_keycode_t  keycode,
+	      int            group,
+	      int            level)
+{
+	return ((gsize) (keycode - model->min_keycode) * model->n_groups + group) *
+		model->n_levels + level;
+}
 
-	signals[CHANGED] =
-		g_signal_new ("changed",
-			      G_OBJECT_CLASS_TYPE (object_class),
-			      G_SIGNAL_RUN_LAST,
-			      0, NULL, NULL, NULL,
-			      G_TYPE_NONE, 0);
+static void
+count_levels_cb (struct xkb_keymap *xkb_keymap,
+		 xkb_keycode_t      keycode,
+		 gpointer           user_data)
+{
+	TeclaModel *model = user_data;
+	int group;
 
-	props[PROP_NAME] =
-		g_param_spec_string ("name",
-				     "Name",
-				     "Name",
-				     NULL,
-				     G_PARAM_READABLE);
+	for (group = 0; group < model->n_groups; group++) {
+		int n_levels;
 
-	g_object_class_install_properties (object_class, N_PROPS, props);
+		n_levels = xkb_keymap_num_levels_for_key (xkb_keymap, keycode, group);
+		model->n_levels = MAX (model->n_levels, n_levels);
+	}
 }
 
 static void
-tecla_model_init (TeclaModel *model)
+fill_key_cb (struct xkb_keymap *xkb_keymap,
+	     xkb_keycode_t      keycode,
+	     gpointer           user_data)
 {
+	TeclaModel *model = user_data;
+	const gchar *name;
+	int group, level;
+
+	name = xkb_keymap_key_get_name (xkb_keymap, keycode);
+	if (name) {
+		name = g_intern_string (name);
+		model->key_names[keycode - model->min_keycode] = name;
+		g_hash_table_insert (model->keycodes_by_name, (gpointer) name,
+				     GUINT_TO_POINTER (keycode));
+	}
+
+	for (group = 0; group < model->n_groups; group++) {
+		for (level = 0; level < model->n_levels; level++) {
+			const xkb_keysym_t *syms;
+			int n_syms;
+
+			n_syms = xkb_keymap_key_get_syms_by_level (xkb_keymap,
+								   keycode,
+								   group,
+								   level,
+								   &syms);
+			if (n_syms == 0)
+				continue;
+
+			model->keysyms[keysym_index (model, keycode, group, level)] = syms[0];
+		}
+	}
 }
 
-static struct {
-        gunichar ch;
-        const char *nick;
-} notable_chars[] = {
-        { 0x00a, "⍽"      }, /* NO-BREAK SPACE */
-        { 0x00ad, "SHY"   }, /* SOFT HYPHEN */
-        { 0x034f, "CGJ"   }, /* COMBINING GRAPHEME JOINER */
-        { 0x061c, "ALM"   }, /* ARABIC LETTER MARK */
-        { 0x200b, "ZWS"   }, /* ZERO WIDTH SPACE */
-        { 0x200c, "ZWNJ"  }, /* ZERO WIDTH NON-JOINER */
-        { 0x200d, "ZWJ"   }, /* ZERO WIDTH JOINER */
-        { 0x200e, "LRM"   }, /* LEFT-TO-RIGHT MARK */
-        { 0x200f, "RLM"   }, /* RIGHT-TO-LEFT MARK */
-        { 0x2028, "LS"    }, /* LINE SEPARATOR */
-        { 0x2029, "PS"    }, /* PARAGRAPH SEPARATOR */
-        { 0x202a, "LRE"   }, /* LEFT-TO-RIGHT EMBEDDING */
-        { 0x202b, "RLE"   }, /* RIGHT-TO-LEFT EMBEDDING */
-        { 0x202c, "PDF"   }, /* POP DIRECTIONAL FORMATTING */
-        { 0x202d, "LRO"   }, /* LEFT-TO-RIGHT OVERRIDE */
-        { 0x202e, "RLO"   }, /* RIGHT-TO-LEFT OVERRIDE */
-        { 0x202f, "⍽"     }, /* NARROW NO-BREAK SPACE */
-        { 0x2060, "WJ"    }, /* WORD JOINER */
-        { 0x2061, "FA"    }, /* FUNCTION APPLICATION */
-        { 0x2062, "IT"    }, /* INVISIBLE TIMES */
-        { 0x2063, "IS"    }, /* INVISIBLE SEPARATOR */
-        { 0x2066, "LRI"   }, /* LEFT-TO-RIGHT ISOLATE */
-        { 0x2067, "RLI"   }, /* RIGHT-TO-LEFT ISOLATE */
-        { 0x2068, "FSI"   }, /* FIRST STRONG ISOLATE */
-        { 0x2069, "PDI"   }, /* POP DIRECTIONAL ISOLATE */
-        { 0xfeff, "ZWNBS" }, /* ZERO WIDTH NO-BREAK SPACE */
-};
+/* The view looks keys up by their geometry name, which may be an
+ * alias in the keymap. Resolve just those, xkbcommon follows aliases.
+ */
+static void
+add_geometry_names (TeclaModel        *model,
+		    struct xkb_keymap *xkb_keymap)
+{
+	gsize i, j;
 
-static const gchar *
-get_unicode_nick (gunichar ch)
+	for (i = 0; i < G_N_ELEMENTS (ansi104_layout.rows); i++) {
+		for (j = 0; j < G_N_ELEMENTS (ansi104_layout.rows[i].keys); j++) {
+			const gchar *name = ansi104_layout.rows[i].keys[j].name;
+			xkb_keycode_t keycode;
+
+			if (!name)
+				break;
+			if (g_hash_table_contains (model->keycodes_by_name, name))
+				continue;
+
+			keycode = xkb_keymap_key_by_name (xkb_keymap, name);
+			if (keycode == XKB_KEYCODE_INVALID)
+				continue;
+
+			g_hash_table_insert (model->keycodes_by_name,
+					     (gpointer) g_intern_string (name),
+					     GUINT_TO_POINTER (keycode));
+		}
+	}
+}
+
+static void
+build_tables (TeclaModel        *model,
+	      struct xkb_keymap *xkb_keymap)
 {
-        for (gsize i = 0; i < G_N_ELEMENTS (notable_chars); i++) {
-                if (ch < notable_chars[i].ch)
-                        return NULL;
+	gsize n_keycodes;
+	int group;
+
+	model->min_keycode = xkb_keymap_min_keycode (xkb_keymap);
+	model->max_keycode = xkb_keymap_max_keycode (xkb_keymap);
+	model->n_groups = MAX (xkb_keymap_num_layouts (xkb_keymap), 1);
 
-                if (ch == notable_chars[i].ch)
-                        return notable_chars[i].nick;
-        }
+	xkb_keymap_key_for_each (xkb_keymap, count_levels_cb, model);
+	model->n_levels = MAX (model->n_levels, 1);
 
-        return NULL;
+	n_keycodes = model->max_keycode - model->min_keycode + 1;
+	model->key_names = g_new0 (const gchar *, n_keycodes);
+	model->keysyms = g_new0 (xkb_keysym_t,
+				 n_keycodes * model->n_groups * model->n_levels);
+	xkb_keymap_key_for_each (xkb_keymap, fill_key_cb, model);
+	add_geometry_names (model, xkb_keymap);
+
+	model->group_names = g_new0 (gchar *, model->n_groups + 1);
+	for (group = 0; group < model->n_groups; group++) {
+		model->group_names[group] =
+			g_strdup (xkb_keymap_layout_get_name (xkb_keymap, group));
+	}
 }
 
-static gchar *
-get_key_label (xkb_keysym_t key)
+G_LOCK_DEFINE_STATIC (labels);
+static GHashTable *labels_by_keysym = NULL;
+
+static const gchar *
+lookup_key_label (xkb_keysym_t keysym)
 {
-	const gchar *label = NULL;
-	gchar buf[5];
-	gunichar uc;
+	const gchar *label;
 
-	switch (key) {
-	case GDK_KEY_Mode_switch:
-	case GDK_KEY_ISO_Level3_Shift:
-		label = "";
-		break;
+	/* Every keysym in xkbcommon-keysyms.h is in the generated table,
+	 * the cache below is left for Unicode and other unnamed keysyms.
+	 */
+	label = tecla_label_table_lookup (keysym);
+	if (label)
+		return label;
 
-	case GDK_KEY_Delete:
-		label = "⌦";
-		break;
+	G_LOCK (labels);
 
-	case GDK_KEY_BackSpace:
-		label = "⌫";
-		break;
+	if (!labels_by_keysym)
+		labels_by_keysym = g_hash_table_new (NULL, NULL);
 
-	case GDK_KEY_space:
-		label = "";
-		break;
+	label = g_hash_table_lookup (labels_by_keysym, GUINT_TO_POINTER (keysym));
 
-	case GDK_KEY_dead_grave:
-		label = "◌̀";
-		break;
+	if (!label) {
+		g_autofree gchar *str = NULL;
 
-	case GDK_KEY_dead_abovecomma:
-		label = "̓◌̓";
-		break;
+		str = tecla_label_compute (keysym);
+		label = g_intern_string (str);
+		g_hash_table_insert (labels_by_keysym,
+				     GUINT_TO_POINTER (keysym),
+				     (gpointer) label);
+	}
 
-	case GDK_KEY_dead_abovereversedcomma:
-		label = "̔◌̔";
-		break;
+	G_UNLOCK (labels);
 
-	case GDK_KEY_dead_acute:
-		label = "◌́";
-		break;
+	return label;
+}
 
-	case GDK_KEY_dead_circumflex:
-		label = "◌̂";
-		break;
+/* Labels every group upfront, so group switches only look them up */
+static void
+build_labels (TeclaModel *model)
+{
+	xkb_keycode_t keycode;
+	gsize n_keycodes, idx;
+	int group, level;
 
-	case GDK_KEY_dead_tilde:
-		label = "◌̃";
-		break;
+	n_keycodes = model->max_keycode - model->min_keycode + 1;
+	model->labels = g_new0 (const gchar *,
+				n_keycodes * model->n_groups * model->n_levels);
 
-	case GDK_KEY_dead_macron:
-		label = "◌̄";
-		break;
+	for (group = 0; group < model->n_groups; group++) {
+		for (keycode = model->min_keycode; keycode <= model->max_keycode; keycode++) {
+			for (level = 0; level < model->n_levels; level++) {
+				idx = keysym_index (model, keycode, group, level);
 
-	case GDK_KEY_dead_breve:
-		label = "◌̆";
-		break;
+				if (model->keysyms[idx] != 0)
+					model->labels[idx] = lookup_key_label (model->keysyms[idx]);
+			}
+		}
+	}
+}
 
-	case GDK_KEY_dead_abovedot:
-		label = "◌̇";
-		break;
+static int
+compare_codepoints (gconstpointer a,
+		    gconstpointer b)
+{
+	gunichar ch_a = *(const gunichar *) a, ch_b = *(const gunichar *) b;
 
-	case GDK_KEY_dead_diaeresis:
-		label = "◌̈";
-		break;
+	return ch_a < ch_b ? -1 : ch_a > ch_b;
+}
 
-	case GDK_KEY_dead_abovering:
-		label = "◌̊";
-		break;
+static void
+build_repertoire (TeclaModel *model)
+{
+	g_autoptr (GHashTable) seen_labels = NULL;
+	g_autoptr (GHashTable) seen_chars = NULL;
+	gsize i, n_labels;
 
-	case GDK_KEY_dead_doubleacute:
-		label = "◌̋";
-		break;
+	seen_labels = g_hash_table_new (NULL, NULL);
+	seen_chars = g_hash_table_new (NULL, NULL);
+	model->codepoints = g_array_new (FALSE, FALSE, sizeof (gunichar));
+	n_labels = (model->max_keycode - model->min_keycode + 1) *
+		model->n_groups * model->n_levels;
 
-	case GDK_KEY_dead_caron:
-		label = "◌̌";
-		break;
+	/* Labels are interned, so most of them are seen already */
+	for (i = 0; i < n_labels; i++) {
+		const gchar *label = model->labels[i], *p;
 
-	case GDK_KEY_dead_cedilla:
-		label = "◌̧";
-		break;
+		if (!label || !g_hash_table_add (seen_labels, (gpointer) label))
+			continue;
 
-	case GDK_KEY_dead_ogonek:
-		label = "◌̨";
-		break;
+		for (p = label; *p; p = g_utf8_next_char (p)) {
+			gunichar ch = g_utf8_get_char (p);
 
-	case GDK_KEY_dead_belowdot:
-		label = "◌̣";
-		break;
+			if (g_hash_table_add (seen_chars, GUINT_TO_POINTER (ch)))
+				g_array_append_val (model->codepoints, ch);
+		}
+	}
 
-	case GDK_KEY_dead_hook:
-		label = "◌̉";
-		break;
+	g_array_sort (model->codepoints, compare_codepoints);
+}
 
-	case GDK_KEY_dead_horn:
-		label = "◌̛";
-		break;
+static int
+compare_index_entries (gconstpointer a,
+		       gconstpointer b)
+{
+	const IndexEntry *ea = a, *eb = b;
+
+	/* Prefer lower groups and levels for the same key */
+	if (ea->key != eb->key)
+		return ea->key < eb->key ? -1 : 1;
+	if (ea->position.group != eb->position.group)
+		return ea->position.group - eb->position.group;
+	if (ea->position.level != eb->position.level)
+		return ea->position.level - eb->position.level;
+
+	return (ea->position.keycode > eb->position.keycode) -
+		(ea->position.keycode < eb->position.keycode);
+}
 
-	case GDK_KEY_dead_stroke:
-		label = "◌̵ ";
-		break;
+static void
+build_reverse_index (ReverseIndex *reverse,
+		     GArray       *entries)
+{
+	guint i;
 
-	case GDK_KEY_dead_hamza:
-		label = "ء";
-		break;
-
-	case GDK_KEY_horizconnector:
-		label = "";
-		break;
-
-	case GDK_KEY_dead_belowcomma:
-		label = "◌̦";
-		break;
+	g_array_sort (entries, compare_index_entries);
 
-	case GDK_KEY_dead_iota:
-		label = "◌ͅ";
-		break;
+	reverse->ranges = g_hash_table_new (NULL, NULL);
+	reverse->range_array = g_array_new (FALSE, FALSE, sizeof (PositionRange));
+	reverse->positions = g_array_sized_new (FALSE, FALSE,
+					      sizeof (TeclaKeyPosition),
+					      entries->len);
 
-	case GDK_KEY_dead_doublegrave:
-		label = "◌̏";
-		break;
+	for (i = 0; i < entries->len; i++) {
+		IndexEntry *entry = &g_array_index (entries, IndexEntry, i);
 
-	case GDK_KEY_dead_belowring:
-		label = "◌̥";
-		break;
+		if (i == 0 || entry->key != g_array_index (entries, IndexEntry, i - 1).key) {
+			PositionRange range = { reverse->positions->len, 0 };
 
-	case GDK_KEY_dead_belowmacron:
-		label = "◌̱";
-		break;
-
-	case GDK_KEY_dead_belowcircumflex:
-		label = "◌̭";
-		break;
-
-	case GDK_KEY_dead_belowtilde:
-		label = "◌̰";
-		break;
-
-	case GDK_KEY_dead_belowbreve:
-		label = "◌̮";
-		break;
-
-	case GDK_KEY_dead_belowdiaeresis:
-		label = "◌̤";
-		break;
-
-	case GDK_KEY_dead_lowline:
-		label = "◌̲";
-		break;
-
-	case GDK_KEY_dead_aboveverticalline:
-		label = "◌̍ ";
-		break;
-
-	case GDK_KEY_dead_belowverticalline:
-		label = "◌̩";
-		break;
-
-	case GDK_KEY_dead_longsolidusoverlay:
-		label = "◌̸ ";
-		break;
-
-	case GDK_KEY_dead_voiced_sound:
-		label = "◌゙";
-		break;
-
-	case GDK_KEY_dead_a:
-		label = "◌ͣ";
-		break;
-
-	case GDK_KEY_dead_e:
-		label = "◌ͤ";
-		break;
-
-	case GDK_KEY_dead_i:
-		label = "◌ͥ";
-		break;
-
-	case GDK_KEY_dead_o:
-		label = "◌ͦ";
-		break;
-
-	case GDK_KEY_dead_u:
-		label = "◌ͧ";
-		break;
-
-	case GDK_KEY_dead_small_schwa:
-		label = "◌ᷪ";
-		break;
-
-	case GDK_KEY_dead_greek:
-		label = "a→α";
-		break;
-
-	case GDK_KEY_dead_currency:
-		label = "e→€";
-		break;
-
-	case GDK_KEY_Multi_key:
-		label = "";
-		break;
-
-	case GDK_KEY_ISO_Enter:
-	case GDK_KEY_Return:
-		label = "⏎";
-		break;
-
-	case GDK_KEY_Shift_L:
-	case GDK_KEY_Shift_R:
-		label = "";
-		break;
-
-	case GDK_KEY_Caps_Lock:
-		label = "";
-		break;
-
-	case GDK_KEY_Tab:
-	case GDK_KEY_ISO_Left_Tab:
-		label = "⭾";
-		break;
-
-	case GDK_KEY_Alt_L:
-	case GDK_KEY_Alt_R:
-		label = "";
-		break;
-
-	case GDK_KEY_Super_L:
-	case GDK_KEY_Super_R:
-		label = "";
-		break;
-
-	case GDK_KEY_Control_L:
-	case GDK_KEY_Control_R:
-		label = "";
-		break;
-
-	case GDK_KEY_Meta_L:
-	case GDK_KEY_Meta_R:
-		label = "";
-		break;
-
-	case GDK_KEY_Menu:
-		label = "";
-		break;
-
-	case GDK_KEY_VoidSymbol:
-		label = "";
-		break;
-
-	case GDK_KEY_nobreakspace:
-		label = "";
-		break;
-
-	default:
-		uc = gdk_keyval_to_unicode (key);
-
-		if (uc != 0 && g_unichar_isgraph (uc)) {
-			buf[g_unichar_to_utf8 (uc, buf)] = '\0';
-			return g_strdup (buf);
-		} else {
-                        const gchar *nick = get_unicode_nick (uc);
-			const gchar *name = gdk_keyval_name (key);
-
-                        if (nick) {
-                                label = nick;
-                        }
-			else if (name) {
-				g_autofree gchar *fixed_name = NULL;
-				gchar *p;
-
-				fixed_name = g_strdup (name);
-
-				/* Replace underscores with spaces */
-				for (p = fixed_name; *p; p++)
-					if (*p == '_')
-						*p = ' ';
-				/* Get rid of scary ISO_ prefix */
-				if (g_strstr_len (fixed_name, -1, "ISO "))
-					return g_strdup (fixed_name + 4);
-				else
-					return g_strdup (fixed_name);
-			} else {
-				return g_strdup ("");
-			}
+			g_array_append_val (reverse->range_array, range);
+			g_hash_table_insert (reverse->ranges,
+					     GUINT_TO_POINTER (entry->key),
+					     GUINT_TO_POINTER (reverse->range_array->len));
 		}
 
-		break;
+		g_array_append_val (reverse->positions, entry->position);
+		g_array_index (reverse->range_array, PositionRange,
+			       reverse->range_array->len - 1).n_positions++;
 	}
+}
+
+static const TeclaKeyPosition *
+lookup_reverse_index (ReverseIndex *reverse,
+		      guint32       key,
+		      gsize        *n_positions)
+{
+	PositionRange *range;
+	guint range_idx;
 
-	return g_strdup (label);
+	range_idx = GPOINTER_TO_UINT (g_hash_table_lookup (reverse->ranges,
+							   GUINT_TO_POINTER (key)));
+	if (range_idx == 0) {
+		*n_positions = 0;
+		return NULL;
+	}
+
+	range = &g_array_index (reverse->range_array, PositionRange, range_idx - 1);
+	*n_positions = range->n_positions;
+
+	return &g_array_index (reverse->positions, TeclaKeyPosition, range->offset);
 }
 
-TeclaModel *
-tecla_model_new_from_xkb_keymap (struct xkb_keymap *xkb_keymap)
+static void
+build_reverse_indexes (TeclaModel *model)
+{
+	g_autoptr (GArray) keysym_entries = NULL;
+	g_autoptr (GArray) char_entries = NULL;
+	xkb_keycode_t keycode;
+	int group, level;
+
+	keysym_entries = g_array_new (FALSE, FALSE, sizeof (IndexEntry));
+	char_entries = g_array_new (FALSE, FALSE, sizeof (IndexEntry));
+
+	for (keycode = model->min_keycode; keycode <= model->max_keycode; keycode++) {
+		for (group = 0; group < model->n_groups; group++) {
+			for (level = 0; level < model->n_levels; level++) {
+				xkb_keysym_t keysym;
+				IndexEntry entry;
+
+				keysym = model->keysyms[keysym_index (model, keycode, group, level)];
+				if (keysym == 0)
+					continue;
+
+				entry.key = keysym;
+				entry.position.keycode = keycode;
+				entry.position.group = group;
+				entry.position.level = level;
+				g_array_append_val (keysym_entries, entry);
+
+				/* Several keysyms may produce the same character */
+				entry.key = xkb_keysym_to_utf32 (keysym);
+				if (entry.key != 0)
+					g_array_append_val (char_entries, entry);
+			}
+		}
+	}
+
+	build_reverse_index (&model->keysym_positions, keysym_entries);
+	build_reverse_index (&model->char_positions, char_entries);
+}
+
+static inline gboolean
+get_entry_index (TeclaModel    *model,
+		 xkb_keycode_t  keycode,
+		 int            group,
+		 int            level,
+		 gsize         *idx)
+{
+	if (keycode < model->min_keycode || keycode > model->max_keycode ||
+	    level < 0 || level >= model->n_levels ||
+	    group < 0 || group >= model->n_groups)
+		return FALSE;
+
+	*idx = keysym_index (model, keycode, group, level);
+
+	return TRUE;
+}
+
+static TeclaModel *
+create_model (struct xkb_keymap *xkb_keymap)
 {
 	TeclaModel *model;
 
 	model = g_object_new (TECLA_TYPE_MODEL, NULL);
-	model->xkb_keymap = xkb_keymap_ref (xkb_keymap);
+	build_tables (model, xkb_keymap);
+	build_labels (model);
+	build_repertoire (model);
+	build_reverse_indexes (model);
 
 	return model;
 }
 
+static gchar *
+get_layout_key (const gchar *layout,
+		const gchar *variant)
+{
+	g_autofree gchar *stripped_layout = NULL;
+	g_autofree gchar *stripped_variant = NULL;
+
+	/* “us+intl”, “us intl” and “ us\tintl” are the same layout */
+	stripped_layout = g_strstrip (g_strdup (layout));
+	stripped_variant = g_strstrip (g_strdup (variant ? variant : ""));
+
+	return g_strdup_printf ("layout:%s+%s", stripped_layout, stripped_variant);
+}
+
+static void
+split_layout_name (const gchar  *name,
+		   gchar       **layout,
+		   const gchar **variant)
+{
+	const gchar *sep;
+
+	sep = strchr (name, '+');
+	if (!sep)
+		sep = strchr (name, ' ');
+	if (!sep)
+		sep = strchr (name, '\t');
+
+	if (sep) {
+		*variant = sep + 1;
+		*layout = g_strndup (name, sep - name);
+	} else {
+		*variant = NULL;
+		*layout = g_strdup (name);
+	}
+}
+
+GArray *
+tecla_model_diff_groups (TeclaModel *model,
+			 int         old_group,
+			 int         new_group)
+{
+	GArray *keycodes;
+	xkb_keycode_t keycode;
+	int level;
+
+	keycodes = g_array_new (FALSE, FALSE, sizeof (xkb_keycode_t));
+
+	for (keycode = model->min_keycode; keycode <= model->max_keycode; keycode++) {
+		for (level = 0; level < model->n_levels; level++) {
+			xkb_keysym_t old_sym = 0, new_sym = 0;
+			gsize idx;
+
+			if (get_entry_index (model, keycode, old_group, level, &idx))
+				old_sym = model->keysyms[idx];
+			if (get_entry_index (model, keycode, new_group, level, &idx))
+				new_sym = model->keysyms[idx];
+
+			if (old_sym != new_sym) {
+				g_array_append_val (keycodes, keycode);
+				break;
+			}
+		}
+	}
+
+	return keycodes;
+}
+
+static TeclaModel *
+new_from_registry_key (struct xkb_keymap *xkb_keymap,
+		       const gchar       *key)
+{
+	TeclaModel *model;
+
+	model = registry_lookup (key);
+	if (model)
+		return model;
+
+	return registry_insert (key, create_model (xkb_keymap));
+}
+
+/* Returns the shared model for keymaps compiled from the same source,
+ * callers hash that text themselves, as they have it at hand.
+ */
+TeclaModel *
+tecla_model_new_from_xkb_keymap_digest (struct xkb_keymap *xkb_keymap,
+					const gchar       *digest)
+{
+	g_autofree gchar *key = NULL;
+
+	key = g_strconcat ("keymap:", digest, NULL);
+
+	return new_from_registry_key (xkb_keymap, key);
+}
+
+/* Returns the shared model if the layout is already compiled */
 TeclaModel *
 tecla_model_new_from_layout_name (const gchar *name)
 {
@@ -450,101 +667,225 @@ tecla_model_new_from_layout_name (const gchar *name)
 	struct xkb_context *xkb_context;
 	struct xkb_keymap *xkb_keymap;
 	g_autofree gchar *layout = NULL;
-	const gchar *variant = NULL, *sep;
+	g_autofree gchar *key = NULL;
+	const gchar *variant;
 	struct xkb_rule_names rule_names = {
 		.rules = "evdev",
 		.model = "pc105",
 	};
 
-	sep = strchr (name, '+');
-	if (!sep)
-		sep = strchr (name, ' ');
-	if (!sep)
-		sep = strchr (name, '\t');
+	split_layout_name (name, &layout, &variant);
+	key = get_layout_key (layout, variant);
 
-	if (sep) {
-		variant = sep + 1;
-		layout = g_strndup (name, sep - name);
-	} else {
-		layout = g_strdup (name);
-	}
+	model = registry_lookup (key);
+	if (model)
+		return model;
 
 	rule_names.layout = layout;
 	rule_names.variant = variant;
 
-	xkb_context = tecla_util_create_xkb_context ();
-	xkb_keymap = xkb_keymap_new_from_names (xkb_context, &rule_names, 0);
+	xkb_context = tecla_util_get_xkb_context ();
+	xkb_keymap = tecla_keymap_cache_compile (xkb_context, &rule_names);
 	xkb_context_unref (xkb_context);
 
 	if (xkb_keymap) {
-		model = tecla_model_new_from_xkb_keymap (xkb_keymap);
+		model = registry_insert (key, create_model (xkb_keymap));
 		xkb_keymap_unref (xkb_keymap);
 	}
 
 	return model;
 }
 
+static void
+new_from_layout_name_thread (GTask        *task,
+			     gpointer      source_object,
+			     gpointer      task_data,
+			     GCancellable *cancellable)
+{
+	const gchar *name = task_data;
+	TeclaModel *model;
+
+	if (g_task_return_error_if_cancelled (task))
+		return;
+
+	model = tecla_model_new_from_layout_name (name);
+
+	if (!model) {
+		g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+					 "Could not compile keymap for layout “%s”",
+					 name);
+		return;
+	}
+
+	g_task_return_pointer (task, model, g_object_unref);
+}
+
+void
+tecla_model_new_from_layout_name_async (const gchar         *name,
+					GCancellable        *cancellable,
+					GAsyncReadyCallback  callback,
+					gpointer             user_data)
+{
+	g_autoptr (GTask) task = NULL;
+	g_autofree gchar *layout = NULL;
+	g_autofree gchar *key = NULL;
+	const gchar *variant;
+	TeclaModel *model;
+
+	task = g_task_new (NULL, cancellable, callback, user_data);
+	g_task_set_source_tag (task, tecla_model_new_from_layout_name_async);
+
+	/* Layouts open elsewhere need no thread at all */
+	split_layout_name (name, &layout, &variant);
+	key = get_layout_key (layout, variant);
+	model = registry_lookup (key);
+	if (model) {
+		g_task_return_pointer (task, model, g_object_unref);
+		return;
+	}
+
+	g_task_set_task_data (task, g_strdup (name), g_free);
+	g_task_run_in_thread (task, new_from_layout_name_thread);
+}
+
+TeclaModel *
+tecla_model_new_from_layout_name_finish (GAsyncResult  *result,
+					 GError       **error)
+{
+	g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+
+	return g_task_propagate_pointer (G_TASK (result), error);
+}
+
 const gchar *
 tecla_model_get_keycode_key (TeclaModel    *model,
 			     xkb_keycode_t  keycode)
 {
-	return xkb_keymap_key_get_name (model->xkb_keymap, keycode);
+	if (keycode < model->min_keycode || keycode > model->max_keycode)
+		return NULL;
+
+	return model->key_names[keycode - model->min_keycode];
 }
 
 xkb_keycode_t
 tecla_model_get_key_keycode (TeclaModel  *model,
 			     const gchar *key)
 {
-	return xkb_keymap_key_by_name (model->xkb_keymap, key);
+	gpointer keycode;
+
+	if (!g_hash_table_lookup_extended (model->keycodes_by_name, key,
+					   NULL, &keycode))
+		return XKB_KEYCODE_INVALID;
+
+	return GPOINTER_TO_UINT (keycode);
+}
+
+const gchar *
+tecla_model_lookup_key_label (TeclaModel  *model,
+			      int          level,
+			      int          group,
+			      const gchar *key)
+{
+	xkb_keycode_t keycode;
+	gsize idx;
+
+	keycode = tecla_model_get_key_keycode (model, key);
+
+	if (!get_entry_index (model, keycode, group, level, &idx))
+		return NULL;
+
+	return model->labels[idx];
 }
 
 gchar *
 tecla_model_get_key_label (TeclaModel  *model,
 			   int          level,
+			   int          group,
 			   const gchar *key)
 {
-	xkb_keycode_t keycode;
-	guint keysym;
+	return g_strdup (tecla_model_lookup_key_label (model, level, group, key));
+}
 
-	keycode = xkb_keymap_key_by_name (model->xkb_keymap, key);
-	keysym = tecla_model_get_keyval (model, level, keycode);
+void
+tecla_model_get_labels (TeclaModel          *model,
+			int                  level,
+			int                  group,
+			const xkb_keycode_t *keycodes,
+			gsize                n_keycodes,
+			const gchar        **labels,
+			xkb_keysym_t        *keysyms)
+{
+	gsize i;
 
-	if (keysym == 0)
-		return NULL;
+	for (i = 0; i < n_keycodes; i++) {
+		gsize idx;
 
-	return get_key_label (keysym);
+		if (!get_entry_index (model, keycodes[i], group, level, &idx)) {
+			if (labels)
+				labels[i] = NULL;
+			if (keysyms)
+				keysyms[i] = 0;
+			continue;
+		}
+
+		if (labels)
+			labels[i] = model->labels[idx];
+		if (keysyms)
+			keysyms[i] = model->keysyms[idx];
+	}
 }
 
 guint
 tecla_model_get_keyval (TeclaModel    *model,
 			int            level,
+			int            group,
 			xkb_keycode_t  keycode)
 {
-	const xkb_keysym_t *syms;
-	int n_syms;
+	gsize idx;
 
-	n_syms = xkb_keymap_key_get_syms_by_level (model->xkb_keymap,
-						   keycode,
-						   model->group,
-						   level,
-						   &syms);
-	if (n_syms == 0)
+	if (!get_entry_index (model, keycode, group, level, &idx))
 		return 0;
 
-	return syms[0];
+	return model->keysyms[idx];
 }
 
 const gchar *
-tecla_model_get_name (TeclaModel *model)
+tecla_model_get_name (TeclaModel *model,
+		      int         group)
+{
+	if (group < 0 || group >= model->n_groups)
+		return NULL;
+
+	return model->group_names[group];
+}
+
+int
+tecla_model_get_n_groups (TeclaModel *model)
 {
-	return xkb_keymap_layout_get_name (model->xkb_keymap, model->group);
+	return model->n_groups;
 }
 
-void
-tecla_model_set_group (TeclaModel *model,
-		       int         group)
+const TeclaKeyPosition *
+tecla_model_lookup_keysym (TeclaModel   *model,
+			   xkb_keysym_t  keysym,
+			   gsize        *n_positions)
 {
-	model->group = group;
-	g_object_notify (G_OBJECT (model), "name");
-	g_signal_emit (model, signals[CHANGED], 0);
+	return lookup_reverse_index (&model->keysym_positions, keysym, n_positions);
+}
+
+const TeclaKeyPosition *
+tecla_model_lookup_char (TeclaModel *model,
+			 gunichar    ch,
+			 gsize      *n_positions)
+{
+	return lookup_reverse_index (&model->char_positions, ch, n_positions);
+}
+
+const gunichar *
+tecla_model_get_codepoints (TeclaModel *model,
+			    gsize      *n_codepoints)
+{
+	*n_codepoints = model->codepoints->len;
+
+	return (const gunichar *) model->codepoints->data;
 }
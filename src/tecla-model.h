@@ -26,25 +26,73 @@
 #define TECLA_TYPE_MODEL (tecla_model_get_type ())
 G_DECLARE_FINAL_TYPE (TeclaModel, tecla_model, TECLA, MODEL, GObject)
 
-TeclaModel * tecla_model_new_from_xkb_keymap (struct xkb_keymap *xkb_keymap);
+typedef struct _TeclaKeyPosition TeclaKeyPosition;
+
+struct _TeclaKeyPosition
+{
+	xkb_keycode_t keycode;
+	int level;
+	int group;
+};
+
+TeclaModel * tecla_model_new_from_xkb_keymap_digest (struct xkb_keymap *xkb_keymap,
+						     const gchar       *digest);
 
 TeclaModel * tecla_model_new_from_layout_name (const gchar *layout);
 
+void tecla_model_new_from_layout_name_async (const gchar         *layout,
+					     GCancellable        *cancellable,
+					     GAsyncReadyCallback  callback,
+					     gpointer             user_data);
+
+TeclaModel * tecla_model_new_from_layout_name_finish (GAsyncResult  *result,
+						      GError       **error);
+
 const gchar * tecla_model_get_keycode_key (TeclaModel    *model,
 					   xkb_keycode_t  keycode);
 
 xkb_keycode_t tecla_model_get_key_keycode (TeclaModel  *model,
 					   const gchar *key);
 
+const gchar * tecla_model_lookup_key_label (TeclaModel  *model,
+					    int          level,
+					    int          group,
+					    const gchar *key);
+
 gchar * tecla_model_get_key_label (TeclaModel  *model,
 				   int          level,
+				   int          group,
 				   const gchar *key);
 
+void tecla_model_get_labels (TeclaModel          *model,
+			     int                  level,
+			     int                  group,
+			     const xkb_keycode_t *keycodes,
+			     gsize                n_keycodes,
+			     const gchar        **labels,
+			     xkb_keysym_t        *keysyms);
+
 guint tecla_model_get_keyval (TeclaModel    *model,
 			      int            level,
+			      int            group,
 			      xkb_keycode_t  keycode);
 
-const gchar * tecla_model_get_name (TeclaModel *model);
+const gchar * tecla_model_get_name (TeclaModel *model,
+				    int         group);
+
+int tecla_model_get_n_groups (TeclaModel *model);
+
+GArray * tecla_model_diff_groups (TeclaModel *model,
+				  int         old_group,
+				  int         new_group);
+
+const TeclaKeyPosition * tecla_model_lookup_keysym (TeclaModel   *model,
+						     xkb_keysym_t  keysym,
+						     gsize        *n_positions);
+
+const TeclaKeyPosition * tecla_model_lookup_char (TeclaModel *model,
+						   gunichar    ch,
+						   gsize      *n_positions);
 
-void tecla_model_set_group (TeclaModel *model,
-			    int         group);
+const gunichar * tecla_model_get_codepoints (TeclaModel *model,
+					     gsize      *n_codepoints);
@@ -0,0 +1,966 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tecla-text-cache-private.h"
+
+#include <pango/pangocairo.h>
+#include <string.h>
+
+/* Enough for the legends of a few dozen layouts */
+#define MAX_BYTES (2 * 1024 * 1024)
+#define ENTRY_OVERHEAD 512
+#define MAX_WORKERS 4
+/* Font, scale and font map combinations kept around */
+#define MAX_CONTEXTS 8
+
+/* What resolving fonts for a codepoint found */
+typedef enum
+{
+	COVERAGE_PENDING = 1,
+	COVERAGE_PRIMARY,
+	COVERAGE_FALLBACK,
+} Coverage;
+
+typedef struct
+{
+	PangoFontDescription *font_desc; /* set if shaped on a worker */
+	PangoFont *font; /* on the UI thread's font map */
+	PangoGlyphString *glyphs;
+	graphene_point_t offset;
+} LegendRun;
+
+struct _TeclaTextLegend
+{
+	PangoRectangle logical_rect; /* in pixels */
+	GArray *runs; /* LegendRun */
+	gsize n_bytes;
+};
+
+typedef struct
+{
+	gchar *key;
+	TeclaTextLegend *legend;
+	gsize n_bytes;
+	GList link;
+} CacheEntry;
+
+/* Everything a worker needs to recreate a context on its own font map */
+typedef struct
+{
+	PangoFontDescription *font_desc;
+	PangoLanguage *language;
+	PangoDirection base_dir;
+	gboolean round_glyph_positions;
+	double resolution;
+	cairo_font_options_t *font_options;
+} ContextParams;
+
+typedef struct
+{
+	gchar *key;
+	gchar *context_key;
+	gchar *text;
+	ContextParams params;
+	int priority;
+	guint serial;
+	GArray *codepoints; /* gunichar, resolves fonts instead if set */
+} ShapeJob;
+
+typedef struct
+{
+	GWeakRef object;
+	TeclaTextCacheReadyFunc func;
+} Waiter;
+
+G_LOCK_DEFINE_STATIC (text_cache);
+static GHashTable *entries = NULL; /* key → CacheEntry */
+static GHashTable *contexts = NULL; /* context key → PangoContext */
+static GQueue context_keys = G_QUEUE_INIT; /* keys of contexts, oldest first */
+static GHashTable *pending = NULL; /* key → ShapeJob, queued or running */
+static GHashTable *waiters = NULL; /* key → GPtrArray of Waiter */
+static GHashTable *coverage = NULL; /* context key → GHashTable of gunichar → Coverage */
+static gboolean prewarm_fonts_enabled = TRUE;
+static GThreadPool *workers = NULL;
+static GQueue lru = G_QUEUE_INIT; /* CacheEntry, most recently used first */
+static gsize cache_bytes = 0;
+static guint cache_hits = 0;
+static guint cache_misses = 0;
+static guint job_serial = 0;
+
+static GPrivate thread_font_map = G_PRIVATE_INIT (g_object_unref);
+static GPrivate thread_contexts = G_PRIVATE_INIT ((GDestroyNotify) g_hash_table_unref);
+
+static void
+legend_run_clear (LegendRun *run)
+{
+	g_clear_pointer (&run->font_desc, pango_font_description_free);
+	g_clear_object (&run->font);
+	g_clear_pointer (&run->glyphs, pango_glyph_string_free);
+}
+
+static void
+legend_clear (TeclaTextLegend *legend)
+{
+	g_array_unref (legend->runs);
+}
+
+TeclaTextLegend *
+tecla_text_legend_ref (TeclaTextLegend *legend)
+{
+	return g_atomic_rc_box_acquire (legend);
+}
+
+void
+tecla_text_legend_unref (TeclaTextLegend *legend)
+{
+	g_atomic_rc_box_release_full (legend, (GDestroyNotify) legend_clear);
+}
+
+void
+tecla_text_legend_get_pixel_extents (TeclaTextLegend *legend,
+				     PangoRectangle  *logical_rect)
+{
+	*logical_rect = legend->logical_rect;
+}
+
+/* Draws like gtk_snapshot_append_layout() does, from the layout origin */
+void
+tecla_text_legend_snapshot (TeclaTextLegend *legend,
+			    GtkSnapshot     *snapshot,
+			    const GdkRGBA   *color)
+{
+	guint i;
+
+	for (i = 0; i < legend->runs->len; i++) {
+		LegendRun *run = &g_array_index (legend->runs, LegendRun, i);
+		GskRenderNode *node;
+
+		if (!run->font)
+			continue;
+
+		node = gsk_text_node_new (run->font, run->glyphs, color, &run->offset);
+		if (node) {
+			gtk_snapshot_append_node (snapshot, node);
+			gsk_render_node_unref (node);
+		}
+	}
+}
+
+/* Copies the glyphs out of a shaped layout. Fonts are only kept if
+ * the layout was shaped on the UI thread's font map, otherwise they
+ * are described so the UI thread can load its own.
+ */
+static TeclaTextLegend *
+legend_new_from_layout (PangoLayout *layout,
+			gboolean     ui_fonts)
+{
+	TeclaTextLegend *legend;
+	PangoLayoutIter *iter;
+
+	legend = g_atomic_rc_box_new0 (TeclaTextLegend);
+	legend->runs = g_array_new (FALSE, TRUE, sizeof (LegendRun));
+	g_array_set_clear_func (legend->runs, (GDestroyNotify) legend_run_clear);
+	legend->n_bytes = ENTRY_OVERHEAD;
+	pango_layout_get_pixel_extents (layout, NULL, &legend->logical_rect);
+
+	iter = pango_layout_get_iter (layout);
+
+	do {
+		PangoLayoutRun *layout_run = pango_layout_iter_get_run_readonly (iter);
+		PangoFont *font;
+		PangoRectangle logical;
+		LegendRun run = { 0, };
+
+		if (!layout_run || layout_run->glyphs->num_glyphs == 0)
+			continue;
+
+		font = layout_run->item->analysis.font;
+		pango_layout_iter_get_run_extents (iter, NULL, &logical);
+
+		if (ui_fonts)
+			run.font = g_object_ref (font);
+		else
+			run.font_desc = pango_font_describe_with_absolute_size (font);
+
+		run.glyphs = pango_glyph_string_copy (layout_run->glyphs);
+		run.offset = GRAPHENE_POINT_INIT ((float) logical.x / PANGO_SCALE,
+						  (float) pango_layout_iter_get_baseline (iter) / PANGO_SCALE);
+		g_array_append_val (legend->runs, run);
+
+		legend->n_bytes += sizeof (LegendRun) + sizeof (PangoGlyphString) +
+			run.glyphs->num_glyphs * (sizeof (PangoGlyphInfo) + sizeof (int));
+	} while (pango_layout_iter_next_run (iter));
+
+	pango_layout_iter_free (iter);
+
+	return legend;
+}
+
+/* Called with the lock held, on the UI thread */
+static void
+legend_load_fonts (TeclaTextLegend *legend,
+		   PangoContext    *context)
+{
+	guint i;
+
+	for (i = 0; i < legend->runs->len; i++) {
+		LegendRun *run = &g_array_index (legend->runs, LegendRun, i);
+
+		if (run->font || !run->font_desc)
+			continue;
+
+		/* Same fontconfig setup, so this finds the font the worker used */
+		run->font = pango_font_map_load_font (pango_context_get_font_map (context),
+						      context, run->font_desc);
+		g_clear_pointer (&run->font_desc, pango_font_description_free);
+	}
+}
+
+static void
+cache_entry_free (CacheEntry *entry)
+{
+	g_free (entry->key);
+	tecla_text_legend_unref (entry->legend);
+	g_free (entry);
+}
+
+static void
+context_params_init (ContextParams *params,
+		     PangoContext  *context)
+{
+	const cairo_font_options_t *font_options;
+
+	params->font_desc = pango_font_description_copy (pango_context_get_font_description (context));
+	params->language = pango_context_get_language (context);
+	params->base_dir = pango_context_get_base_dir (context);
+	params->round_glyph_positions = pango_context_get_round_glyph_positions (context);
+	params->resolution = pango_cairo_context_get_resolution (context);
+
+	font_options = pango_cairo_context_get_font_options (context);
+	params->font_options = font_options ? cairo_font_options_copy (font_options) : NULL;
+}
+
+static void
+context_params_clear (ContextParams *params)
+{
+	g_clear_pointer (&params->font_desc, pango_font_description_free);
+	g_clear_pointer (&params->font_options, cairo_font_options_destroy);
+}
+
+static PangoContext *
+create_context (PangoFontMap        *font_map,
+		const ContextParams *params)
+{
+	PangoContext *context;
+
+	context = pango_font_map_create_context (font_map);
+	pango_context_set_font_description (context, params->font_desc);
+	pango_context_set_language (context, params->language);
+	pango_context_set_base_dir (context, params->base_dir);
+	pango_context_set_round_glyph_positions (context, params->round_glyph_positions);
+	pango_cairo_context_set_resolution (context, params->resolution);
+	pango_cairo_context_set_font_options (context, params->font_options);
+
+	return context;
+}
+
+static void
+shape_job_free (ShapeJob *job)
+{
+	g_free (job->key);
+	g_free (job->context_key);
+	g_free (job->text);
+	context_params_clear (&job->params);
+	g_clear_pointer (&job->codepoints, g_array_unref);
+	g_free (job);
+}
+
+static void
+waiter_free (Waiter *waiter)
+{
+	g_weak_ref_clear (&waiter->object);
+	g_free (waiter);
+}
+
+static gchar *
+get_context_key (PangoContext *context,
+		 int           scale)
+{
+	const cairo_font_options_t *options;
+	g_autofree gchar *font = NULL;
+
+	font = pango_font_description_to_string (pango_context_get_font_description (context));
+	options = pango_cairo_context_get_font_options (context);
+
+	/* Legends hold fonts of this font map */
+	return g_strdup_printf ("%p|%s|%s|%d|%d|%g|%lx",
+				pango_context_get_font_map (context), font,
+				pango_language_to_string (pango_context_get_language (context)),
+				pango_context_get_base_dir (context),
+				scale,
+				pango_cairo_context_get_resolution (context),
+				options ? cairo_font_options_hash (options) : 0);
+}
+
+/* Layouts are shaped on contexts owned by the cache, so they stay
+ * valid however the widget that requested them changes later on.
+ */
+static PangoContext *
+get_shared_context (PangoContext *context,
+		    const gchar  *context_key)
+{
+	PangoContext *shared;
+	ContextParams params;
+	gchar *shared_key;
+
+	shared = g_hash_table_lookup (contexts, context_key);
+	if (shared)
+		return shared;
+
+	/* Legends don't reference contexts, dropping them is safe */
+	while (g_queue_get_length (&context_keys) >= MAX_CONTEXTS)
+		g_hash_table_remove (contexts, g_queue_pop_head (&context_keys));
+
+	context_params_init (&params, context);
+	shared = create_context (pango_context_get_font_map (context), &params);
+	context_params_clear (&params);
+	shared_key = g_strdup (context_key);
+	g_hash_table_insert (contexts, shared_key, shared);
+	g_queue_push_tail (&context_keys, shared_key);
+
+	return shared;
+}
+
+/* Called with the lock held, on the UI thread. Legends hold fonts of
+ * the UI font map, so they must not be freed elsewhere.
+ */
+static void
+evict_entries (void)
+{
+	while (cache_bytes > MAX_BYTES && lru.length > 1) {
+		CacheEntry *entry = g_queue_peek_tail (&lru);
+
+		g_queue_unlink (&lru, &entry->link);
+		cache_bytes -= entry->n_bytes;
+		g_hash_table_remove (entries, entry->key);
+	}
+}
+
+static void
+ensure_tables (void)
+{
+	if (entries)
+		return;
+
+	entries = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+					 (GDestroyNotify) cache_entry_free);
+	contexts = g_hash_table_new_full (g_str_hash, g_str_equal,
+					  g_free, g_object_unref);
+	pending = g_hash_table_new (g_str_hash, g_str_equal);
+	waiters = g_hash_table_new_full (g_str_hash, g_str_equal,
+					 g_free, (GDestroyNotify) g_ptr_array_unref);
+	coverage = g_hash_table_new_full (g_str_hash, g_str_equal,
+					  g_free, (GDestroyNotify) g_hash_table_unref);
+}
+
+/* Takes the legend. Eviction is left to the UI thread */
+static CacheEntry *
+insert_entry (const gchar     *key,
+	      TeclaTextLegend *legend)
+{
+	CacheEntry *entry;
+
+	entry = g_new0 (CacheEntry, 1);
+	entry->key = g_strdup (key);
+	entry->link.data = entry;
+	entry->legend = legend;
+	entry->n_bytes = legend->n_bytes + strlen (key);
+
+	g_hash_table_insert (entries, entry->key, entry);
+	g_queue_push_head_link (&lru, &entry->link);
+	cache_bytes += entry->n_bytes;
+
+	return entry;
+}
+
+/* Called with the lock held, on the UI thread */
+static TeclaTextLegend *
+lookup_entry (PangoContext *context,
+	      const gchar  *key)
+{
+	CacheEntry *entry;
+
+	entry = g_hash_table_lookup (entries, key);
+	if (!entry)
+		return NULL;
+
+	cache_hits++;
+	g_queue_unlink (&lru, &entry->link);
+	g_queue_push_head_link (&lru, &entry->link);
+	legend_load_fonts (entry->legend, context);
+
+	return tecla_text_legend_ref (entry->legend);
+}
+
+static gboolean
+notify_waiters (gpointer user_data)
+{
+	GPtrArray *ready = user_data;
+	guint i;
+
+	for (i = 0; i < ready->len; i++) {
+		Waiter *waiter = g_ptr_array_index (ready, i);
+		g_autoptr (GObject) object = NULL;
+
+		object = g_weak_ref_get (&waiter->object);
+		if (object)
+			waiter->func (object);
+	}
+
+	return G_SOURCE_REMOVE;
+}
+
+static PangoContext *
+get_thread_context (ShapeJob *job)
+{
+	PangoFontMap *font_map;
+	GHashTable *thread_table;
+	PangoContext *context;
+
+	/* Workers never touch the font map of the UI thread, nor hand
+	 * out anything referencing their own.
+	 */
+	font_map = g_private_get (&thread_font_map);
+	if (!font_map) {
+		font_map = pango_cairo_font_map_new ();
+		g_private_set (&thread_font_map, font_map);
+	}
+
+	thread_table = g_private_get (&thread_contexts);
+	if (!thread_table) {
+		thread_table = g_hash_table_new_full (g_str_hash, g_str_equal,
+						      g_free, g_object_unref);
+		g_private_set (&thread_contexts, thread_table);
+	}
+
+	context = g_hash_table_lookup (thread_table, job->context_key);
+	if (!context) {
+		if (g_hash_table_size (thread_table) >= MAX_CONTEXTS)
+			g_hash_table_remove_all (thread_table);
+
+		context = create_context (font_map, &job->params);
+		g_hash_table_insert (thread_table, g_strdup (job->context_key), context);
+	}
+
+	return context;
+}
+
+/* Walks font fallback on this worker's font map. The font files it
+ * opens stay in cairo's process wide cache, and the UI thread learns
+ * which text it may shape inline without running into fallback.
+ */
+static void
+resolve_job_fonts (ShapeJob *job)
+{
+	g_autofree gboolean *fallback = NULL;
+	GHashTable *context_coverage;
+	gsize n_fallback;
+	gint64 start;
+	guint i;
+
+	start = g_get_monotonic_time ();
+	fallback = g_new0 (gboolean, job->codepoints->len);
+	n_fallback = tecla_text_cache_resolve_fonts (get_thread_context (job),
+						     (const gunichar *) job->codepoints->data,
+						     job->codepoints->len,
+						     fallback);
+
+	G_LOCK (text_cache);
+
+	g_hash_table_remove (pending, job->key);
+
+	context_coverage = g_hash_table_lookup (coverage, job->context_key);
+	for (i = 0; context_coverage && i < job->codepoints->len; i++) {
+		g_hash_table_insert (context_coverage,
+				     GUINT_TO_POINTER (g_array_index (job->codepoints, gunichar, i)),
+				     GUINT_TO_POINTER (fallback[i] ? COVERAGE_FALLBACK : COVERAGE_PRIMARY));
+	}
+
+	G_UNLOCK (text_cache);
+
+	g_debug ("Resolved fonts for %u codepoints in %.1f ms, "
+		 "%" G_GSIZE_FORMAT " need fallback",
+		 job->codepoints->len,
+		 (g_get_monotonic_time () - start) / 1000.0,
+		 n_fallback);
+}
+
+static void
+shape_job_run (ShapeJob *job,
+	       gpointer  user_data)
+{
+	g_autoptr (PangoLayout) layout = NULL;
+	TeclaTextLegend *legend;
+	GPtrArray *ready = NULL;
+
+	if (job->codepoints) {
+		resolve_job_fonts (job);
+		shape_job_free (job);
+		return;
+	}
+
+	layout = pango_layout_new (get_thread_context (job));
+	pango_layout_set_text (layout, job->text, -1);
+	legend = legend_new_from_layout (layout, FALSE);
+
+	G_LOCK (text_cache);
+
+	g_hash_table_remove (pending, job->key);
+
+	/* Holds no worker fonts, so the UI thread may free it */
+	if (!g_hash_table_contains (entries, job->key))
+		insert_entry (job->key, g_steal_pointer (&legend));
+
+	g_hash_table_steal_extended (waiters, job->key, NULL, (gpointer *) &ready);
+
+	G_UNLOCK (text_cache);
+
+	g_clear_pointer (&legend, tecla_text_legend_unref);
+
+	if (ready) {
+		g_idle_add_full (G_PRIORITY_DEFAULT, notify_waiters,
+				 ready, (GDestroyNotify) g_ptr_array_unref);
+	}
+
+	shape_job_free (job);
+}
+
+static gint
+compare_jobs (gconstpointer a,
+	      gconstpointer b,
+	      gpointer      user_data)
+{
+	const ShapeJob *job_a = a, *job_b = b;
+
+	if (job_a->priority != job_b->priority)
+		return job_a->priority < job_b->priority ? -1 : 1;
+
+	return job_a->serial < job_b->serial ? -1 : 1;
+}
+
+static ShapeJob *
+shape_job_new (PangoContext *context,
+	       const gchar  *context_key,
+	       int           priority)
+{
+	ShapeJob *job;
+
+	job = g_new0 (ShapeJob, 1);
+	job->priority = priority;
+	job->context_key = g_strdup (context_key);
+	job->serial = job_serial++;
+	context_params_init (&job->params, context);
+
+	return job;
+}
+
+/* Called with the lock held */
+static void
+push_job (ShapeJob *job)
+{
+	if (!workers) {
+		workers = g_thread_pool_new ((GFunc) shape_job_run, NULL,
+					     MIN ((int) g_get_num_processors (), MAX_WORKERS),
+					     FALSE, NULL);
+		g_thread_pool_set_sort_function (workers, compare_jobs, NULL);
+	}
+
+	g_hash_table_insert (pending, job->key, job);
+	g_thread_pool_push (workers, job, NULL);
+}
+
+/* Called with the lock held */
+static void
+queue_job (PangoContext *context,
+	   const gchar  *context_key,
+	   const gchar  *key,
+	   const gchar  *text,
+	   int           priority)
+{
+	ShapeJob *job;
+
+	if (g_hash_table_contains (entries, key) ||
+	    g_hash_table_contains (pending, key))
+		return;
+
+	job = shape_job_new (context, context_key, priority);
+	job->key = g_strdup (key);
+	job->text = g_strdup (text);
+	push_job (job);
+}
+
+static gboolean
+is_ascii (const gchar *text)
+{
+	const gchar *p;
+
+	for (p = text; *p; p++) {
+		if ((guchar) *p >= 0x80)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gboolean
+needs_complex_shaping (const gchar *text)
+{
+	const gchar *p;
+
+	for (p = text; *p; p = g_utf8_next_char (p)) {
+		switch (g_unichar_get_script (g_utf8_get_char (p))) {
+		case G_UNICODE_SCRIPT_COMMON:
+		case G_UNICODE_SCRIPT_INHERITED:
+		case G_UNICODE_SCRIPT_LATIN:
+		case G_UNICODE_SCRIPT_GREEK:
+		case G_UNICODE_SCRIPT_CYRILLIC:
+			break;
+		default:
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+/* Called with the lock held. Simple text that the primary font is
+ * known to cover shapes faster than a round trip to a worker, the
+ * rest goes to one rather than stalling the frame on font fallback.
+ * Coverage comes from tecla_text_cache_prewarm_fonts().
+ */
+static gboolean
+can_shape_inline (const gchar *context_key,
+		  const gchar *text)
+{
+	GHashTable *context_coverage;
+	const gchar *p;
+
+	if (is_ascii (text))
+		return TRUE;
+	if (needs_complex_shaping (text))
+		return FALSE;
+
+	context_coverage = g_hash_table_lookup (coverage, context_key);
+	if (!context_coverage)
+		return FALSE;
+
+	for (p = text; *p; p = g_utf8_next_char (p)) {
+		gunichar ch = g_utf8_get_char (p);
+
+		if (ch >= 0x80 &&
+		    GPOINTER_TO_UINT (g_hash_table_lookup (context_coverage,
+							   GUINT_TO_POINTER (ch))) != COVERAGE_PRIMARY)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Must be called from the UI thread, as all legend getters */
+TeclaTextLegend *
+tecla_text_cache_get_legend (PangoContext *context,
+			     const gchar  *text,
+			     int           scale)
+{
+	g_autofree gchar *context_key = NULL;
+	g_autofree gchar *key = NULL;
+	TeclaTextLegend *legend;
+
+	context_key = get_context_key (context, scale);
+	key = g_strconcat (context_key, "|", text, NULL);
+
+	G_LOCK (text_cache);
+
+	ensure_tables ();
+	legend = lookup_entry (context, key);
+
+	if (!legend) {
+		g_autoptr (PangoLayout) layout = NULL;
+		gint64 start, elapsed_us;
+
+		cache_misses++;
+		start = g_get_monotonic_time ();
+
+		layout = pango_layout_new (get_shared_context (context, context_key));
+		pango_layout_set_text (layout, text, -1);
+		legend = legend_new_from_layout (layout, TRUE);
+		insert_entry (key, tecla_text_legend_ref (legend));
+
+		elapsed_us = g_get_monotonic_time () - start;
+		if (elapsed_us > 2000)
+			g_debug ("Shaping “%s” took %.1f ms", text, elapsed_us / 1000.0);
+	}
+
+	evict_entries ();
+
+	G_UNLOCK (text_cache);
+
+	return legend;
+}
+
+/* Called with the lock held */
+static void
+add_waiter (const gchar             *key,
+	    GObject                 *object,
+	    TeclaTextCacheReadyFunc  ready_func)
+{
+	GPtrArray *key_waiters;
+	Waiter *waiter;
+	guint i;
+
+	key_waiters = g_hash_table_lookup (waiters, key);
+	if (!key_waiters) {
+		key_waiters = g_ptr_array_new_with_free_func ((GDestroyNotify) waiter_free);
+		g_hash_table_insert (waiters, g_strdup (key), key_waiters);
+	}
+
+	/* Canvases ask again on every redraw while text is pending */
+	for (i = 0; i < key_waiters->len; i++) {
+		g_autoptr (GObject) waiting = NULL;
+
+		waiter = g_ptr_array_index (key_waiters, i);
+		waiting = g_weak_ref_get (&waiter->object);
+		if (waiting == object && waiter->func == ready_func)
+			return;
+	}
+
+	waiter = g_new0 (Waiter, 1);
+	g_weak_ref_init (&waiter->object, object);
+	waiter->func = ready_func;
+	g_ptr_array_add (key_waiters, waiter);
+}
+
+/* Returns NULL while text is shaped in the background,
+ * ready_func is called on the main context once it is cached.
+ */
+TeclaTextLegend *
+tecla_text_cache_try_get_legend (PangoContext            *context,
+				 const gchar             *text,
+				 int                      scale,
+				 GObject                 *object,
+				 TeclaTextCacheReadyFunc  ready_func)
+{
+	g_autofree gchar *context_key = NULL;
+	g_autofree gchar *key = NULL;
+	TeclaTextLegend *legend;
+
+	context_key = get_context_key (context, scale);
+	key = g_strconcat (context_key, "|", text, NULL);
+
+	G_LOCK (text_cache);
+
+	ensure_tables ();
+
+	if (can_shape_inline (context_key, text)) {
+		G_UNLOCK (text_cache);
+		return tecla_text_cache_get_legend (context, text, scale);
+	}
+
+	legend = lookup_entry (context, key);
+
+	if (!legend) {
+		cache_misses++;
+		queue_job (context, context_key, key, text, 0);
+		add_waiter (key, object, ready_func);
+	}
+
+	evict_entries ();
+
+	G_UNLOCK (text_cache);
+
+	return legend;
+}
+
+void
+tecla_text_cache_prewarm (PangoContext        *context,
+			  int                  scale,
+			  const gchar * const *texts,
+			  gsize                n_texts,
+			  int                  priority)
+{
+	g_autofree gchar *context_key = NULL;
+	gsize i;
+
+	context_key = get_context_key (context, scale);
+
+	G_LOCK (text_cache);
+
+	ensure_tables ();
+
+	for (i = 0; i < n_texts; i++) {
+		g_autofree gchar *key = NULL;
+
+		/* Shaped on demand, quicker than the handoff */
+		if (!texts[i] || !*texts[i] || can_shape_inline (context_key, texts[i]))
+			continue;
+
+		key = g_strconcat (context_key, "|", texts[i], NULL);
+		queue_job (context, context_key, key, texts[i], priority);
+	}
+
+	G_UNLOCK (text_cache);
+}
+
+gsize
+tecla_text_cache_resolve_fonts (PangoContext   *context,
+				const gunichar *codepoints,
+				gsize           n_codepoints,
+				gboolean       *fallback)
+{
+	g_autoptr (PangoFontset) fontset = NULL;
+	g_autoptr (PangoFont) primary = NULL;
+	gsize i, n_fallback = 0;
+
+	fontset = pango_font_map_load_fontset (pango_context_get_font_map (context),
+					       context,
+					       pango_context_get_font_description (context),
+					       pango_context_get_language (context));
+	if (!fontset)
+		return 0;
+
+	/* Every font has a space, so this is the first font of the set */
+	primary = pango_fontset_get_font (fontset, ' ');
+
+	for (i = 0; i < n_codepoints; i++) {
+		g_autoptr (PangoFont) font = NULL;
+
+		/* This walks the fallback chain until some font covers it */
+		font = pango_fontset_get_font (fontset, codepoints[i]);
+
+		if (font != primary)
+			n_fallback++;
+		if (fallback)
+			fallback[i] = font != primary;
+	}
+
+	return n_fallback;
+}
+
+/* Resolves font fallback for the codepoints on a worker, ahead of the
+ * first frames. Until then text needing it is shaped on workers too.
+ */
+void
+tecla_text_cache_prewarm_fonts (PangoContext   *context,
+				int             scale,
+				const gunichar *codepoints,
+				gsize           n_codepoints)
+{
+	g_autofree gchar *context_key = NULL;
+	GHashTable *context_coverage;
+	ShapeJob *job = NULL;
+	gsize i;
+
+	context_key = get_context_key (context, scale);
+
+	G_LOCK (text_cache);
+
+	ensure_tables ();
+
+	if (!prewarm_fonts_enabled) {
+		G_UNLOCK (text_cache);
+		return;
+	}
+
+	context_coverage = g_hash_table_lookup (coverage, context_key);
+	if (!context_coverage) {
+		if (g_hash_table_size (coverage) >= MAX_CONTEXTS)
+			g_hash_table_remove_all (coverage);
+
+		context_coverage = g_hash_table_new (NULL, NULL);
+		g_hash_table_insert (coverage, g_strdup (context_key),
+				     context_coverage);
+	}
+
+	for (i = 0; i < n_codepoints; i++) {
+		if (codepoints[i] < 0x80 ||
+		    g_hash_table_contains (context_coverage,
+					   GUINT_TO_POINTER (codepoints[i])))
+			continue;
+
+		g_hash_table_insert (context_coverage,
+				     GUINT_TO_POINTER (codepoints[i]),
+				     GUINT_TO_POINTER (COVERAGE_PENDING));
+
+		if (!job) {
+			/* Ahead of shaping, which learns from it */
+			job = shape_job_new (context, context_key, -1);
+			job->key = g_strdup_printf ("fonts|%u|%s", job->serial, context_key);
+			job->codepoints = g_array_new (FALSE, FALSE, sizeof (gunichar));
+		}
+
+		g_array_append_val (job->codepoints, codepoints[i]);
+	}
+
+	if (job)
+		push_job (job);
+
+	G_UNLOCK (text_cache);
+}
+
+void
+tecla_text_cache_get_stats (guint *hits,
+			    guint *misses,
+			    gsize *n_bytes)
+{
+	G_LOCK (text_cache);
+
+	if (hits)
+		*hits = cache_hits;
+	if (misses)
+		*misses = cache_misses;
+	if (n_bytes)
+		*n_bytes = cache_bytes;
+
+	G_UNLOCK (text_cache);
+}
+
+void
+tecla_text_cache_set_prewarm_fonts_enabled (gboolean enabled)
+{
+	G_LOCK (text_cache);
+	prewarm_fonts_enabled = enabled;
+	G_UNLOCK (text_cache);
+}
+
+/* Shaping and font jobs queued or running */
+guint
+tecla_text_cache_get_n_pending (void)
+{
+	guint n_pending = 0;
+
+	G_LOCK (text_cache);
+
+	if (pending)
+		n_pending = g_hash_table_size (pending);
+
+	G_UNLOCK (text_cache);
+
+	return n_pending;
+}
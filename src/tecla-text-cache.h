@@ -0,0 +1,73 @@
+/* Copyright (C) 2023 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Carlos Garnacho <carlosg@gnome.org>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <gtk/gtk.h>
+
+#pragma once
+
+/* Shaped text, as glyphs on the UI thread's fonts. Immutable, so it
+ * can be shared by every widget showing the same legend.
+ */
+typedef struct _TeclaTextLegend TeclaTextLegend;
+
+typedef void (* TeclaTextCacheReadyFunc) (GObject *object);
+
+TeclaTextLegend * tecla_text_legend_ref (TeclaTextLegend *legend);
+
+void tecla_text_legend_unref (TeclaTextLegend *legend);
+
+void tecla_text_legend_get_pixel_extents (TeclaTextLegend *legend,
+					  PangoRectangle  *logical_rect);
+
+void tecla_text_legend_snapshot (TeclaTextLegend *legend,
+				 GtkSnapshot     *snapshot,
+				 const GdkRGBA   *color);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (TeclaTextLegend, tecla_text_legend_unref)
+
+TeclaTextLegend * tecla_text_cache_get_legend (PangoContext *context,
+					       const gchar  *text,
+					       int           scale);
+
+TeclaTextLegend * tecla_text_cache_try_get_legend (PangoContext            *context,
+						   const gchar             *text,
+						   int                      scale,
+						   GObject                 *object,
+						   TeclaTextCacheReadyFunc  ready_func);
+
+void tecla_text_cache_prewarm (PangoContext        *context,
+			       int                  scale,
+			       const gchar * const *texts,
+			       gsize                n_texts,
+			       int                  priority);
+
+void tecla_text_cache_prewarm_fonts (PangoContext   *context,
+				     int             scale,
+				     const gunichar *codepoints,
+				     gsize           n_codepoints);
+
+gsize tecla_text_cache_resolve_fonts (PangoContext   *context,
+				      const gunichar *codepoints,
+				      gsize           n_codepoints,
+				      gboolean       *fallback);
+
+void tecla_text_cache_get_stats (guint *hits,
+				 guint *misses,
+				 gsize *n_bytes);
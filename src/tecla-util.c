@@ -21,33 +21,159 @@
 #include "tecla-util.h"
 
 #include <gtk/gtk.h>
+#include <glib/gstdio.h>
 
-struct xkb_context *
-tecla_util_create_xkb_context (void)
+typedef struct
 {
   struct xkb_context *ctx;
-  char xdg[1024] = {0};
+  guint generation;
+} ContextSlot;
+
+static void context_slot_free (gpointer data);
+
+/* Contexts are not thread-safe, so each thread gets its own one */
+static GPrivate context_slot = G_PRIVATE_INIT (context_slot_free);
+
+G_LOCK_DEFINE_STATIC (include_paths);
+static GStrv include_paths = NULL;
+static gint64 user_dir_mtime = 0;
+static guint generation = 0;
+
+static void
+context_slot_free (gpointer data)
+{
+  ContextSlot *slot = data;
+
+  g_clear_pointer (&slot->ctx, xkb_context_unref);
+  g_free (slot);
+}
+
+gchar *
+tecla_util_get_user_xkb_dir (void)
+{
   const char *env;
 
+  if ((env = g_getenv ("XDG_CONFIG_HOME")))
+    return g_strdup_printf ("%s/xkb", env);
+  else if ((env = g_getenv ("HOME")))
+    return g_strdup_printf ("%s/.config/xkb", env);
+
+  return NULL;
+}
+
+gint64
+tecla_util_get_xkb_dir_mtime (const gchar *dir)
+{
+  const gchar *subdirs[] = { "", "rules", "keycodes", "symbols", "types", "compat" };
+  gint64 mtime = -1;
+  gsize i;
+
+  for (i = 0; i < G_N_ELEMENTS (subdirs); i++)
+    {
+      g_autofree gchar *path = NULL;
+      GStatBuf st;
+
+      path = g_build_filename (dir, subdirs[i], NULL);
+      if (g_stat (path, &st) == 0)
+        mtime = MAX (mtime, (gint64) st.st_mtime);
+    }
+
+  return mtime;
+}
+
+static struct xkb_context *
+create_xkb_context (void)
+{
+  struct xkb_context *ctx;
+  g_autofree gchar *xdg = NULL;
+
   /*
    * We can only append search paths in libxkbcommon, so we start with an
    * empty set, then add the XDG dir, then add the default search paths.
    */
   ctx = xkb_context_new (XKB_CONTEXT_NO_DEFAULT_INCLUDES);
 
-  if ((env = g_getenv ("XDG_CONFIG_HOME")))
+  xdg = tecla_util_get_user_xkb_dir ();
+  if (xdg)
+    xkb_context_include_path_append (ctx, xdg);
+
+  xkb_context_include_path_append_default (ctx);
+
+  return ctx;
+}
+
+static guint
+update_include_paths (void)
+{
+  g_autofree gchar *user_dir = NULL;
+  gint64 mtime = -1;
+  guint current;
+
+  user_dir = tecla_util_get_user_xkb_dir ();
+  if (user_dir)
+    mtime = tecla_util_get_xkb_dir_mtime (user_dir);
+
+  G_LOCK (include_paths);
+
+  if (!include_paths || mtime != user_dir_mtime)
     {
-      g_snprintf (xdg, sizeof xdg, "%s/xkb", env);
+      struct xkb_context *ctx;
+      GPtrArray *paths;
+      unsigned int i;
+
+      /* Resolve the search paths once, contexts created afterwards
+       * just copy them.
+       */
+      ctx = create_xkb_context ();
+      paths = g_ptr_array_new ();
+
+      for (i = 0; i < xkb_context_num_include_paths (ctx); i++)
+        g_ptr_array_add (paths, g_strdup (xkb_context_include_path_get (ctx, i)));
+
+      g_ptr_array_add (paths, NULL);
+      xkb_context_unref (ctx);
+
+      g_strfreev (include_paths);
+      include_paths = (GStrv) g_ptr_array_free (paths, FALSE);
+      user_dir_mtime = mtime;
+      generation++;
     }
-  else if ((env = g_getenv ("HOME")))
+
+  current = generation;
+
+  G_UNLOCK (include_paths);
+
+  return current;
+}
+
+struct xkb_context *
+tecla_util_get_xkb_context (void)
+{
+  ContextSlot *slot;
+  guint current;
+
+  current = update_include_paths ();
+
+  slot = g_private_get (&context_slot);
+  if (!slot)
     {
-      g_snprintf (xdg, sizeof xdg, "%s/.config/xkb", env);
+      slot = g_new0 (ContextSlot, 1);
+      g_private_set (&context_slot, slot);
     }
 
-  if (env)
-    xkb_context_include_path_append (ctx, xdg);
+  if (!slot->ctx || slot->generation != current)
+    {
+      int i;
 
-  xkb_context_include_path_append_default (ctx);
+      g_clear_pointer (&slot->ctx, xkb_context_unref);
+      slot->ctx = xkb_context_new (XKB_CONTEXT_NO_DEFAULT_INCLUDES);
+      slot->generation = current;
 
-  return ctx;
+      G_LOCK (include_paths);
+      for (i = 0; include_paths[i]; i++)
+        xkb_context_include_path_append (slot->ctx, include_paths[i]);
+      G_UNLOCK (include_paths);
+    }
+
+  return xkb_context_ref (slot->ctx);
 }
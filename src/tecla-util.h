@@ -18,8 +18,13 @@
  * SPDX-License-Identifier: GPL-2.0-or-later
  */
 
+#include <glib.h>
 #include <xkbcommon/xkbcommon.h>
 
 #pragma once
 
-struct xkb_context * tecla_util_create_xkb_context (void);
+struct xkb_context * tecla_util_get_xkb_context (void);
+
+gchar * tecla_util_get_user_xkb_dir (void);
+
+gint64 tecla_util_get_xkb_dir_mtime (const gchar *dir);
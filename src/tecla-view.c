@@ -19,12 +19,15 @@
  */
 
 #include <gtk/gtk.h>
+#include <string.h>
 #include <xkbcommon/xkbcommon.h>
 
-#include "tecla-view.h"
+#include "tecla-view-private.h"
 
 #include "ansi104.h"
+#include "tecla-canvas.h"
 #include "tecla-key.h"
+#include "tecla-text-cache.h"
 
 enum
 {
@@ -36,14 +39,29 @@ struct _TeclaView
 {
 	GtkWidget parent_instance;
 	GtkWidget *grid;
-	GHashTable *keys_by_name;
-	TeclaModel *model;
-	guint model_changed_id;
-
-	GList *level2_keys; // Shift keys
-	GList *level3_keys; // AltGr keys
+	GtkWidget *canvas; /* TeclaCanvas, in single-widget mode */
+	GHashTable *slots_by_name; /* key name → slot + 1 */
+	GPtrArray *key_names; /* interned, one per slot */
+	GPtrArray *keys; /* TeclaKey*, one per slot unless single-widget */
+	GArray *keycodes; /* xkb_keycode_t, one per slot */
+	xkb_keysym_t *base_keysyms;
+	const gchar **labels;
+	const gchar **labels_altgr;
+	TeclaModel *model; /* shared, never changes */
+	int group;
+	guint highlighted_slot; /* slot + 1, 0 if none */
+
+	guint *slots_by_keycode; /* slot + 1, 0 if none */
+	xkb_keycode_t n_slots_by_keycode;
+	guint8 *key_roles; /* LEVEL2_PRESSED/LEVEL3_PRESSED, one per slot */
 	guint toggled_levels;
 	int level; // 0: base, 1: shift, 2: altgr, 3: shift+altgr
+	gboolean single_widget;
+
+	guint update_tick_id;
+	gboolean update_all;
+	gboolean prewarm_pending;
+	GArray *changed_keycodes; /* xkb_keycode_t, pending relabels */
 };
 
 G_DEFINE_TYPE (TeclaView, tecla_view, GTK_TYPE_WIDGET)
@@ -54,11 +72,17 @@ enum
 	PROP_MODEL,
 	PROP_LEVEL,
 	PROP_NUM_LEVELS,
+	PROP_SINGLE_WIDGET,
+	PROP_GROUP,
 	N_PROPS,
 };
 
 static GParamSpec *props[N_PROPS];
 
+/* Interned once, key labels compare by pointer */
+static const gchar *level2_label = NULL;
+static const gchar *level3_label = NULL;
+
 enum
 {
 	KEY_ACTIVATED,
@@ -67,7 +91,8 @@ enum
 
 static guint signals[N_SIGNALS] = { 0, };
 
-static void update_view (TeclaView *view);
+static void queue_update (TeclaView *view,
+			  GArray    *keycodes);
 
 static void
 tecla_view_set_property (GObject      *object,
@@ -81,6 +106,12 @@ tecla_view_set_property (GObject      *object,
 	case PROP_MODEL:
 		tecla_view_set_model (view, g_value_get_object (value));
 		break;
+	case PROP_SINGLE_WIDGET:
+		tecla_view_set_single_widget (view, g_value_get_boolean (value));
+		break;
+	case PROP_GROUP:
+		tecla_view_set_group (view, g_value_get_int (value));
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
@@ -105,6 +136,12 @@ tecla_view_get_property (GObject    *object,
 	case PROP_NUM_LEVELS:
 		g_value_set_int (value, tecla_view_get_num_levels (view));
 		break;
+	case PROP_SINGLE_WIDGET:
+		g_value_set_boolean (value, view->single_widget);
+		break;
+	case PROP_GROUP:
+		g_value_set_int (value, view->group);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
@@ -116,53 +153,117 @@ tecla_view_finalize (GObject *object)
 {
 	TeclaView *view = TECLA_VIEW (object);
 
-	g_hash_table_unref (view->keys_by_name);
-	g_clear_list (&view->level2_keys, NULL);
-	g_clear_list (&view->level3_keys, NULL);
+	g_hash_table_unref (view->slots_by_name);
+	g_ptr_array_unref (view->key_names);
+	g_ptr_array_unref (view->keys);
+	g_array_unref (view->keycodes);
+	g_array_unref (view->changed_keycodes);
+	g_free (view->base_keysyms);
+	g_free (view->labels);
+	g_free (view->labels_altgr);
+	g_free (view->slots_by_keycode);
+	g_free (view->key_roles);
 	gtk_widget_unparent (gtk_widget_get_first_child (GTK_WIDGET (view)));
 
 	G_OBJECT_CLASS (tecla_view_parent_class)->finalize (object);
 }
 
+static GtkWidget *
+get_key_widget (TeclaView *view,
+		guint      i)
+{
+	if (view->canvas)
+		return view->canvas;
+
+	return g_ptr_array_index (view->keys, i);
+}
+
 static void
-update_toggled_key_list (TeclaView *view,
-			 GList     *keys,
-			 guint      flag)
+set_key_state (TeclaView     *view,
+	       guint          i,
+	       GtkStateFlags  flags,
+	       gboolean       set)
 {
-	GList *l;
+	GtkWidget *key;
 
-	for (l = keys; l; l = l->next) {
-		GtkWidget *key;
+	if (view->canvas) {
+		TeclaCanvasKeyState state = 0;
 
-		key = g_hash_table_lookup (view->keys_by_name, l->data);
+		if ((flags & GTK_STATE_FLAG_ACTIVE) != 0)
+			state |= TECLA_CANVAS_KEY_ACTIVE;
+		if ((flags & GTK_STATE_FLAG_SELECTED) != 0)
+			state |= TECLA_CANVAS_KEY_SELECTED;
 
-		if ((view->toggled_levels & flag) != 0)
-			gtk_widget_set_state_flags (key, GTK_STATE_FLAG_SELECTED, FALSE);
-		else
-			gtk_widget_unset_state_flags (key, GTK_STATE_FLAG_SELECTED);
+		tecla_canvas_set_key_state (TECLA_CANVAS (view->canvas), i, state, set);
+		return;
+	}
+
+	key = g_ptr_array_index (view->keys, i);
+
+	if (set)
+		gtk_widget_set_state_flags (key, flags, FALSE);
+	else
+		gtk_widget_unset_state_flags (key, flags);
+}
+
+static void
+set_key_highlighted (TeclaView *view,
+		     guint      i,
+		     gboolean   highlighted)
+{
+	GtkWidget *key;
+
+	if (view->canvas) {
+		tecla_canvas_set_key_state (TECLA_CANVAS (view->canvas), i,
+					    TECLA_CANVAS_KEY_HIGHLIGHTED,
+					    highlighted);
+		return;
 	}
+
+	key = g_ptr_array_index (view->keys, i);
+
+	if (highlighted)
+		gtk_widget_add_css_class (key, "highlighted");
+	else
+		gtk_widget_remove_css_class (key, "highlighted");
 }
 
 static void
-update_toggled_keys (TeclaView   *view,
-		     const gchar *pressed_key_name)
+update_toggled_key_list (TeclaView *view)
 {
-	const gchar *name = pressed_key_name;
+	guint i;
 
-	if (g_list_find_custom (view->level2_keys, name, (GCompareFunc) g_strcmp0)) {
-		if ((view->toggled_levels & LEVEL2_PRESSED) != 0)
-			view->toggled_levels &= ~LEVEL2_PRESSED;
-		else
-			view->toggled_levels |= LEVEL2_PRESSED;
-	} else if (g_list_find_custom (view->level3_keys, name, (GCompareFunc) g_strcmp0)) {
-		if ((view->toggled_levels & LEVEL3_PRESSED) != 0)
-			view->toggled_levels &= ~LEVEL3_PRESSED;
-		else
-			view->toggled_levels |= LEVEL3_PRESSED;
+	for (i = 0; i < view->key_names->len; i++) {
+		if (view->key_roles[i] == 0)
+			continue;
+
+		set_key_state (view, i, GTK_STATE_FLAG_SELECTED,
+			       (view->toggled_levels & view->key_roles[i]) != 0);
 	}
+}
 
-	update_toggled_key_list (view, view->level2_keys, LEVEL2_PRESSED);
-	update_toggled_key_list (view, view->level3_keys, LEVEL3_PRESSED);
+static void
+update_toggled_keys (TeclaView *view,
+		     guint      roles)
+{
+	if ((roles & LEVEL2_PRESSED) != 0)
+		view->toggled_levels ^= LEVEL2_PRESSED;
+	else if ((roles & LEVEL3_PRESSED) != 0)
+		view->toggled_levels ^= LEVEL3_PRESSED;
+	else
+		return;
+
+	update_toggled_key_list (view);
+}
+
+static guint
+get_key_slot (TeclaView     *view,
+	      xkb_keycode_t  keycode)
+{
+	if (keycode >= view->n_slots_by_keycode)
+		return 0;
+
+	return view->slots_by_keycode[keycode];
 }
 
 static void
@@ -184,7 +285,7 @@ update_level (TeclaView *view)
 
 	view->level = level;
 	g_object_notify (G_OBJECT (view), "level");
-	update_view (view);
+	queue_update (view, NULL);
 }
 
 static void
@@ -218,29 +319,71 @@ key_activated_cb (TeclaKey  *key,
 		  TeclaView *view)
 {
 	const gchar *name;
+	guint slot;
 
 	name = tecla_key_get_name (key);
 	g_signal_emit (view, signals[KEY_ACTIVATED], 0, name, key);
 
-	update_toggled_keys (view, name);
+	/* Paired keys share the slot of the first one */
+	slot = GPOINTER_TO_UINT (g_hash_table_lookup (view->slots_by_name, name));
+	if (slot != 0)
+		update_toggled_keys (view, view->key_roles[slot - 1]);
+
+	update_level (view);
+}
+
+static void
+canvas_key_activated_cb (TeclaCanvas *canvas,
+			 guint        slot,
+			 TeclaView   *view)
+{
+	g_signal_emit (view, signals[KEY_ACTIVATED], 0,
+		       g_ptr_array_index (view->key_names, slot),
+		       GTK_WIDGET (canvas));
+	update_toggled_keys (view, view->key_roles[slot]);
 	update_level (view);
 }
 
 static void
-construct_grid (TeclaView *view)
+clear_keys (TeclaView *view)
+{
+	GtkWidget *child;
+
+	while ((child = gtk_widget_get_first_child (view->grid)) != NULL)
+		gtk_grid_remove (GTK_GRID (view->grid), child);
+
+	g_ptr_array_set_size (view->keys, 0);
+	view->canvas = NULL;
+}
+
+static void
+construct_keys (TeclaView *view)
 {
 	gulong i, j;
 	int anchor = 0;
 
+	clear_keys (view);
+
 	/* make sure we show the keyboard layout in RTL same as in LTR */
 	gtk_widget_set_direction (view->grid, GTK_TEXT_DIR_LTR);
 
+	if (view->single_widget) {
+		view->canvas = tecla_canvas_new ();
+		g_signal_connect (view->canvas, "key-activated",
+				  G_CALLBACK (canvas_key_activated_cb), view);
+		gtk_widget_add_css_class (view->canvas, "tecla-key");
+		gtk_widget_set_hexpand (view->canvas, TRUE);
+		gtk_widget_set_vexpand (view->canvas, TRUE);
+		gtk_grid_attach (GTK_GRID (view->grid), view->canvas, 0, 0, 1, 1);
+	}
+
 	for (i = 0; i < G_N_ELEMENTS (ansi104_layout.rows); i++) {
 		for (j = 0; j < G_N_ELEMENTS (ansi104_layout.rows[i].keys); j++) {
 			TeclaLayoutKey *key;
-			GtkWidget *button, *prev;
+			GtkWidget *button;
 			double width, height;
 			int left, top;
+			guint slot;
 
 			key = &ansi104_layout.rows[i].keys[j];
 			if (!key->name)
@@ -250,6 +393,26 @@ construct_grid (TeclaView *view)
 			top = key->height >= 0 ? i : i + key->height + 1;
 			width = MAX (key->width, 1) * 4;
 			height = MAX (fabs (key->height), 1);
+			anchor += (int) width;
+
+			/* Paired keys share the slot of the first one */
+			slot = GPOINTER_TO_UINT (g_hash_table_lookup (view->slots_by_name,
+								      key->name));
+			if (slot == 0) {
+				g_ptr_array_add (view->key_names,
+						 (gpointer) g_intern_string (key->name));
+				slot = view->key_names->len;
+				g_hash_table_insert (view->slots_by_name,
+						     g_ptr_array_index (view->key_names, slot - 1),
+						     GUINT_TO_POINTER (slot));
+			}
+
+			if (view->canvas) {
+				tecla_canvas_add_key (TECLA_CANVAS (view->canvas),
+						      slot - 1, left, top,
+						      (int) width, (int) height);
+				continue;
+			}
 
 			button = tecla_key_new (key->name);
 			g_signal_connect (button, "activated",
@@ -261,34 +424,33 @@ construct_grid (TeclaView *view)
 					 (int) width,
 					 (int) height);
 
-			anchor += (int) width;
-
-			prev = g_hash_table_lookup (view->keys_by_name,
-						    key->name);
-
-			if (prev) {
-				pair_state (prev, button);
-			} else {
-				g_hash_table_insert (view->keys_by_name,
-						     (gpointer) tecla_key_get_name (TECLA_KEY (button)),
-						     button);
-			}
+			if (slot <= view->keys->len)
+				pair_state (g_ptr_array_index (view->keys, slot - 1), button);
+			else
+				g_ptr_array_add (view->keys, button);
 		}
 
 		anchor = 0;
 	}
-
-	gtk_widget_set_layout_manager (GTK_WIDGET (view), gtk_bin_layout_new ());
 }
 
 static void
 tecla_view_constructed (GObject *object)
 {
 	TeclaView *view = TECLA_VIEW (object);
+	guint n_slots;
 
 	G_OBJECT_CLASS (tecla_view_parent_class)->constructed (object);
 
-	construct_grid (view);
+	construct_keys (view);
+
+	n_slots = view->key_names->len;
+	view->base_keysyms = g_new0 (xkb_keysym_t, n_slots);
+	view->labels = g_new0 (const gchar *, n_slots);
+	view->labels_altgr = g_new0 (const gchar *, n_slots);
+	view->key_roles = g_new0 (guint8, n_slots);
+
+	gtk_widget_set_layout_manager (GTK_WIDGET (view), gtk_bin_layout_new ());
 }
 
 static void
@@ -302,6 +464,9 @@ tecla_view_class_init (TeclaViewClass *klass)
 	object_class->finalize = tecla_view_finalize;
 	object_class->constructed = tecla_view_constructed;
 
+	level2_label = g_intern_static_string ("⬆");
+	level3_label = g_intern_static_string ("⎇");
+
 	signals[KEY_ACTIVATED] =
 		g_signal_new ("key-activated",
 			      G_OBJECT_CLASS_TYPE (object_class),
@@ -329,6 +494,22 @@ tecla_view_class_init (TeclaViewClass *klass)
 				  "Number of levels",
 				  0, G_MAXINT, 0,
 				  G_PARAM_READABLE);
+	/* Defaults to the environment so the whole app can be switched */
+	props[PROP_SINGLE_WIDGET] =
+		g_param_spec_boolean ("single-widget",
+				      "Single widget",
+				      "Draw all keys from a single widget",
+				      g_strcmp0 (g_getenv ("TECLA_SINGLE_WIDGET"), "1") == 0,
+				      G_PARAM_READWRITE |
+				      G_PARAM_CONSTRUCT |
+				      G_PARAM_EXPLICIT_NOTIFY);
+	props[PROP_GROUP] =
+		g_param_spec_int ("group",
+				  "Group",
+				  "Group",
+				  0, G_MAXINT, 0,
+				  G_PARAM_READWRITE |
+				  G_PARAM_EXPLICIT_NOTIFY);
 
 	g_object_class_install_properties (object_class, N_PROPS, props);
 
@@ -343,20 +524,7 @@ key_pressed_cb (GtkEventControllerKey *controller,
 		GdkModifierType        modifiers,
 		TeclaView             *view)
 {
-	const gchar *name;
-	GtkWidget *key;
-
-	if (!view->model)
-		return;
-
-	name = tecla_model_get_keycode_key (view->model, keycode);
-	key = g_hash_table_lookup (view->keys_by_name, name);
-
-	if (key)
-		gtk_widget_set_state_flags (key, GTK_STATE_FLAG_ACTIVE, FALSE);
-
-	update_toggled_keys (view, name);
-	update_level (view);
+	tecla_view_handle_key_event (view, keycode, TRUE);
 }
 
 static void
@@ -366,19 +534,7 @@ key_released_cb (GtkEventControllerKey *controller,
 		 GdkModifierType        modifiers,
 		 TeclaView             *view)
 {
-	const gchar *name;
-	GtkWidget *key;
-
-	if (!view->model)
-		return;
-
-	name = tecla_model_get_keycode_key (view->model, keycode);
-	key = g_hash_table_lookup (view->keys_by_name, name);
-
-	if (key)
-		gtk_widget_unset_state_flags (key, GTK_STATE_FLAG_ACTIVE);
-
-	g_signal_emit (view, signals[KEY_ACTIVATED], 0, name, key);
+	tecla_view_handle_key_event (view, keycode, FALSE);
 }
 
 static void
@@ -387,7 +543,11 @@ tecla_view_init (TeclaView *view)
 	GtkEventController *controller;
 
 	gtk_widget_init_template (GTK_WIDGET (view));
-	view->keys_by_name = g_hash_table_new (g_str_hash, g_str_equal);
+	view->slots_by_name = g_hash_table_new (g_str_hash, g_str_equal);
+	view->key_names = g_ptr_array_new ();
+	view->keys = g_ptr_array_new ();
+	view->keycodes = g_array_new (FALSE, FALSE, sizeof (xkb_keycode_t));
+	view->changed_keycodes = g_array_new (FALSE, FALSE, sizeof (xkb_keycode_t));
 
 	controller = gtk_event_controller_key_new ();
 	g_signal_connect (controller, "key-pressed",
@@ -400,74 +560,88 @@ tecla_view_init (TeclaView *view)
 }
 
 static void
-update_from_model_foreach (const gchar *name,
-			   GtkWidget   *key_widget, // Cambiado de TeclaKey* a GtkWidget* para que coincida con GHFunc
-			   TeclaView   *view)
-{
-	TeclaKey *key = TECLA_KEY(key_widget); // Hacer el cast aquí
-	xkb_keycode_t keycode;
-	g_autofree gchar *action_main = NULL;
-	g_autofree gchar *action_altgr = NULL;
-	guint keyval_main;
-    int altgr_paired_level;
-
-	if (!view->model) { // Añadir una guarda por si el modelo no está listo
-		tecla_key_set_label(key, "");
-		tecla_key_set_label_altgr(key, "");
-		return;
-	}
+update_key (TeclaView   *view,
+	    guint        i,
+	    const gchar *label,
+	    const gchar *label_altgr)
+{
+	/* Level modifiers get a fixed label */
+	if (view->key_roles[i] == LEVEL2_PRESSED)
+		label = level2_label;
+	else if (view->key_roles[i] == LEVEL3_PRESSED)
+		label = level3_label;
+
+	if (view->canvas) {
+		tecla_canvas_set_key_labels (TECLA_CANVAS (view->canvas), i,
+					     label, label_altgr);
+	} else {
+		TeclaKey *key = g_ptr_array_index (view->keys, i);
 
-	keycode = tecla_model_get_key_keycode (view->model, name);
-	keyval_main = tecla_model_get_keyval (view->model, 0, keycode); // Nivel 0 para identificar Shift/AltGr
-
-    // Identificar teclas Shift y AltGr para la lógica de `view->level2_keys` y `view->level3_keys`
-    // Esta parte es para la gestión interna de niveles, no para las etiquetas en sí.
-	if (keyval_main == GDK_KEY_Shift_L || keyval_main == GDK_KEY_Shift_R) {
-		if (!g_list_find_custom (view->level2_keys, name, (GCompareFunc) g_strcmp0))
-			view->level2_keys = g_list_prepend (view->level2_keys, (gpointer) name);
-		action_main = g_strdup ("⬆");
-	} else if (keyval_main == GDK_KEY_ISO_Level3_Shift) { // Esta es la tecla AltGr
-		if (!g_list_find_custom (view->level3_keys, name, (GCompareFunc) g_strcmp0))
-			view->level3_keys = g_list_prepend (view->level3_keys, (gpointer) name);
-		action_main = g_strdup ("⎇");
+		tecla_key_set_label (key, label);
+		tecla_key_set_label_altgr (key, label_altgr);
 	}
+}
 
+static void
+get_label_levels (TeclaView *view,
+		  int       *main_level,
+		  int       *altgr_level)
+{
+	/* The main label shows the base or Shift level, the AltGr label
+	 * the AltGr level, paired with Shift if that is toggled.
+	 */
+	*main_level = view->level % 2;
+	*altgr_level = (view->toggled_levels & LEVEL2_PRESSED) != 0 ? 3 : 2;
+}
 
-    // Obtener etiqueta principal (nivel base o nivel Shift)
-    // view->level ya refleja el estado actual de los modificadores (0:base, 1:Shift, 2:AltGr, 3:Shift+AltGr)
-    // Para la etiqueta principal, nos interesan los niveles 0 y 1.
-    // Si AltGr está pulsado (level 2 o 3), la etiqueta principal debería seguir siendo la de nivel 0 o 1.
-    // O, si queremos que la etiqueta principal refleje el estado de Shift incluso con AltGr:
-    int main_label_level = view->level % 2; // 0 si level es 0 o 2; 1 si level es 1 o 3. Esto es (Base o AltGr) y (Shift o Shift+AltGr)
-
+static void
+update_roles (TeclaView *view)
+{
+	guint i, n_keys;
 
-    if (!action_main) { // Si no es una tecla especial como Shift o AltGr
-        action_main = tecla_model_get_key_label (view->model, main_label_level, name);
-    }
+	n_keys = view->key_names->len;
 
+	if (!view->model) {
+		memset (view->key_roles, 0, n_keys);
+		return;
+	}
 
-	// Obtener etiqueta AltGr (nivel AltGr o nivel Shift+AltGr)
-    // Determinamos el nivel para la etiqueta AltGr basado en si Shift está presionado o no.
-    if ((view->toggled_levels & LEVEL2_PRESSED) != 0) { // Shift está presionado
-        altgr_paired_level = 3; // Nivel Shift + AltGr
-    } else { // Shift no está presionado
-        altgr_paired_level = 2; // Nivel AltGr
-    }
-    action_altgr = tecla_model_get_key_label(view->model, altgr_paired_level, name);
+	tecla_model_get_labels (view->model, 0,
+				view->group,
+				(const xkb_keycode_t *) view->keycodes->data, n_keys,
+				NULL, view->base_keysyms);
 
-	tecla_key_set_label (key, action_main ? action_main : "");
-    tecla_key_set_label_altgr (key, action_altgr ? action_altgr : "");
+	for (i = 0; i < n_keys; i++) {
+		xkb_keysym_t base_keysym = view->base_keysyms[i];
 
-    // g_free(action_main) y g_free(action_altgr) son manejados por g_autofree
+		if (base_keysym == GDK_KEY_Shift_L || base_keysym == GDK_KEY_Shift_R)
+			view->key_roles[i] = LEVEL2_PRESSED;
+		else if (base_keysym == GDK_KEY_ISO_Level3_Shift)
+			view->key_roles[i] = LEVEL3_PRESSED;
+		else
+			view->key_roles[i] = 0;
+	}
 }
 
 static void
 update_view (TeclaView *view)
 {
-	if (!view->model) return; // Añadir guarda
-	g_hash_table_foreach (view->keys_by_name,
-			      (GHFunc) update_from_model_foreach,
-			      view);
+	int main_level, altgr_level, group;
+	const xkb_keycode_t *keycodes;
+	guint i, n_keys;
+
+	n_keys = view->key_names->len;
+	keycodes = (const xkb_keycode_t *) view->keycodes->data;
+	group = view->group;
+	get_label_levels (view, &main_level, &altgr_level);
+
+	tecla_model_get_labels (view->model, main_level, group, keycodes, n_keys,
+				view->labels, NULL);
+	tecla_model_get_labels (view->model, altgr_level, group, keycodes, n_keys,
+				view->labels_altgr, NULL);
+
+	for (i = 0; i < n_keys; i++)
+		update_key (view, i, view->labels[i], view->labels_altgr[i]);
 }
 
 GtkWidget *
@@ -476,27 +650,222 @@ tecla_view_new (void)
 	return g_object_new (TECLA_TYPE_VIEW, NULL);
 }
 
+static gboolean
+keycode_in_array (GArray        *keycodes,
+		  xkb_keycode_t  keycode)
+{
+	guint i;
+
+	for (i = 0; i < keycodes->len; i++) {
+		if (g_array_index (keycodes, xkb_keycode_t, i) == keycode)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
 static void
-model_changed_cb (TeclaModel *model,
-		  TeclaView  *view)
+update_changed_keys (TeclaView *view,
+		     GArray    *keycodes)
 {
-	// Limpiar las listas de teclas de nivel ANTES de llamar a update_view,
-    // ya que update_from_model_foreach las repoblará.
-	g_clear_list (&view->level2_keys, NULL);
-	g_clear_list (&view->level3_keys, NULL);
+	int main_level, altgr_level, group;
+	guint i;
 
-	view->toggled_levels = 0;
-	view->level = 0; // Resetear al nivel base
-	update_toggled_key_list (view, view->level2_keys, LEVEL2_PRESSED); // Esto no hará nada si las listas están vacías
-	update_toggled_key_list (view, view->level3_keys, LEVEL3_PRESSED); // ""
-	// update_level (view); // Se llamará dentro de set_model o al final de esta función si es necesario.
+	group = view->group;
+	get_label_levels (view, &main_level, &altgr_level);
+
+	for (i = 0; i < view->key_names->len; i++) {
+		const xkb_keycode_t *keycode;
+
+		keycode = &g_array_index (view->keycodes, xkb_keycode_t, i);
+		if (!keycode_in_array (keycodes, *keycode))
+			continue;
+
+		tecla_model_get_labels (view->model, main_level, group, keycode, 1,
+					&view->labels[i], NULL);
+		tecla_model_get_labels (view->model, altgr_level, group, keycode, 1,
+					&view->labels_altgr[i], NULL);
+		update_key (view, i, view->labels[i], view->labels_altgr[i]);
+	}
+}
+
+static void
+prewarm_legends (TeclaView *view)
+{
+	g_autofree const gchar **labels = NULL;
+	int main_level, altgr_level, level, group;
+	PangoContext *context;
+	GtkWidget *widget;
+	guint n_keys;
+
+	n_keys = view->key_names->len;
+	if (!view->model || n_keys == 0)
+		return;
+
+	/* All keys share the same font */
+	widget = get_key_widget (view, 0);
+	context = gtk_widget_get_pango_context (widget);
+	labels = g_new0 (const gchar *, n_keys);
+	group = view->group;
+	get_label_levels (view, &main_level, &altgr_level);
+
+	/* Shape the visible levels first, the rest in case they get toggled */
+	for (level = 0; level < 4; level++) {
+		tecla_model_get_labels (view->model, level, group,
+					(const xkb_keycode_t *) view->keycodes->data,
+					n_keys, labels, NULL);
+		tecla_text_cache_prewarm (context,
+					  gtk_widget_get_scale_factor (widget),
+					  labels, n_keys,
+					  level == main_level || level == altgr_level ? 0 : 1);
+	}
+}
+
+static void
+flush_update (TeclaView *view)
+{
+	guint i;
+
+	/* Shaping is queued from here too, so it happens once per frame */
+	if (view->prewarm_pending) {
+		view->prewarm_pending = FALSE;
+		prewarm_legends (view);
+	}
+
+	if (view->model) {
+		if (view->update_all)
+			update_view (view);
+		else if (view->changed_keycodes->len > 0)
+			update_changed_keys (view, view->changed_keycodes);
+	} else if (view->update_all) {
+		/* No model, no legends */
+		for (i = 0; i < view->key_names->len; i++)
+			update_key (view, i, NULL, NULL);
+	}
+
+	view->update_all = FALSE;
+	g_array_set_size (view->changed_keycodes, 0);
+}
+
+static gboolean
+update_tick_cb (GtkWidget     *widget,
+		GdkFrameClock *frame_clock,
+		gpointer       user_data)
+{
+	TeclaView *view = TECLA_VIEW (widget);
+
+	view->update_tick_id = 0;
+	flush_update (view);
+
+	return G_SOURCE_REMOVE;
+}
+
+/* Relabeling happens once per frame, in the frame clock update phase.
+ * NULL keycodes means all keys.
+ */
+static void
+queue_update (TeclaView *view,
+	      GArray    *keycodes)
+{
+	if (!keycodes) {
+		view->update_all = TRUE;
+	} else if (!view->update_all) {
+		g_array_append_vals (view->changed_keycodes,
+				     keycodes->data, keycodes->len);
+
+		/* A full update is cheaper past this point */
+		if (view->changed_keycodes->len > view->key_names->len)
+			view->update_all = TRUE;
+	}
+
+	if (view->update_tick_id == 0) {
+		view->update_tick_id =
+			gtk_widget_add_tick_callback (GTK_WIDGET (view),
+						      update_tick_cb,
+						      NULL, NULL);
+	}
+}
+
+static void
+resolve_keycodes (TeclaView *view)
+{
+	xkb_keycode_t max_keycode = 0;
+	guint i;
+
+	g_array_set_size (view->keycodes, view->key_names->len);
+
+	for (i = 0; i < view->key_names->len; i++) {
+		xkb_keycode_t keycode = XKB_KEYCODE_INVALID;
+
+		if (view->model) {
+			keycode = tecla_model_get_key_keycode (view->model,
+							       g_ptr_array_index (view->key_names, i));
+		}
+
+		g_array_index (view->keycodes, xkb_keycode_t, i) = keycode;
+		view->key_roles[i] = 0;
+
+		if (keycode != XKB_KEYCODE_INVALID)
+			max_keycode = MAX (max_keycode, keycode);
+	}
 
-	update_view (view); // Esto repoblará level2_keys/level3_keys y establecerá etiquetas
+	/* Direct keycode → key lookups for hardware events */
+	g_free (view->slots_by_keycode);
+	view->n_slots_by_keycode = max_keycode + 1;
+	view->slots_by_keycode = g_new0 (guint, view->n_slots_by_keycode);
 
-    // Después de update_view, los toggled_levels podrían haber cambiado si las teclas Shift/AltGr
-    // se procesaron. Forzamos una actualización de nivel y notificamos.
-    update_level(view); // Asegura que el nivel se recalcula y notifica si es necesario.
+	for (i = 0; i < view->key_names->len; i++) {
+		xkb_keycode_t keycode = g_array_index (view->keycodes, xkb_keycode_t, i);
 
+		if (keycode != XKB_KEYCODE_INVALID)
+			view->slots_by_keycode[keycode] = i + 1;
+	}
+}
+
+static void
+prewarm_fonts (TeclaView *view)
+{
+	const gunichar *codepoints;
+	GtkWidget *widget;
+	gsize n_codepoints;
+
+	if (!view->model || view->key_names->len == 0)
+		return;
+
+	/* Resolve font fallback for the whole keymap once, on a worker */
+	widget = get_key_widget (view, 0);
+	codepoints = tecla_model_get_codepoints (view->model, &n_codepoints);
+	tecla_text_cache_prewarm_fonts (gtk_widget_get_pango_context (widget),
+					gtk_widget_get_scale_factor (widget),
+					codepoints, n_codepoints);
+}
+
+/* NULL keycodes means all keys changed */
+static void
+keys_changed (TeclaView *view,
+	      GArray    *keycodes)
+{
+	int n_levels;
+
+	/* Roles are needed right away to handle key events */
+	n_levels = tecla_view_get_num_levels (view);
+	update_roles (view);
+
+	/* Only relabel the keys that differ, unless a level needs resetting */
+	view->prewarm_pending = TRUE;
+
+	if (keycodes && view->toggled_levels == 0) {
+		queue_update (view, keycodes);
+
+		if (n_levels != tecla_view_get_num_levels (view))
+			g_object_notify (G_OBJECT (view), "num-levels");
+		return;
+	}
+
+	view->toggled_levels = 0;
+	view->level = 0; // Resetear al nivel base
+	update_toggled_key_list (view); // Deselecciona las teclas de nivel actuales
+	queue_update (view, NULL);
 
 	g_object_notify (G_OBJECT (view), "num-levels"); // Notificar cambio en el número de niveles
 	g_object_notify (G_OBJECT (view), "level");      // Notificar cambio de nivel
@@ -509,30 +878,59 @@ tecla_view_set_model (TeclaView  *view,
 	if (view->model == model)
 		return;
 
-	if (view->model_changed_id) {
-		g_signal_handler_disconnect (view->model, view->model_changed_id);
-		view->model_changed_id = 0;
-	}
+	tecla_view_set_highlighted_key (view, XKB_KEYCODE_INVALID);
+
+	view->toggled_levels = 0;
+	update_toggled_key_list (view);
 
 	g_set_object (&view->model, model);
+	resolve_keycodes (view);
 
 	if (view->model) {
-		view->model_changed_id =
-			g_signal_connect (view->model, "changed",
-					  G_CALLBACK (model_changed_cb), view);
-        model_changed_cb (view->model, view); // Llamar para la configuración inicial con el nuevo modelo
+		if (view->group >= tecla_model_get_n_groups (view->model)) {
+			view->group = 0;
+			g_object_notify (G_OBJECT (view), "group");
+		}
+
+		prewarm_fonts (view);
+		keys_changed (view, NULL);
 	} else {
         // Si el modelo se establece a NULL, limpiar la vista
-        view->toggled_levels = 0;
         view->level = 0;
-        g_clear_list (&view->level2_keys, NULL);
-	    g_clear_list (&view->level3_keys, NULL);
-        update_view(view); // Limpiará las etiquetas
+        update_roles (view);
+        queue_update (view, NULL);
         g_object_notify (G_OBJECT (view), "num-levels");
 	    g_object_notify (G_OBJECT (view), "level");
     }
 }
 
+int
+tecla_view_get_group (TeclaView *view)
+{
+	return view->group;
+}
+
+void
+tecla_view_set_group (TeclaView *view,
+		      int        group)
+{
+	g_autoptr (GArray) keycodes = NULL;
+
+	if (view->group == group)
+		return;
+
+	/* All groups are labelled upfront, so only relabel keys that differ */
+	if (view->model)
+		keycodes = tecla_model_diff_groups (view->model, view->group, group);
+
+	view->group = group;
+
+	if (view->model)
+		keys_changed (view, keycodes);
+
+	g_object_notify (G_OBJECT (view), "group");
+}
+
 int
 tecla_view_get_current_level (TeclaView *view)
 {
@@ -558,14 +956,15 @@ tecla_view_set_current_level (TeclaView *view,
 	if (view->toggled_levels == toggled_levels) return;
 
 	view->toggled_levels = toggled_levels;
-	update_toggled_key_list (view, view->level2_keys, LEVEL2_PRESSED);
-	update_toggled_key_list (view, view->level3_keys, LEVEL3_PRESSED);
-	update_level (view); // Esto actualizará view->level y llamará a update_view
+	update_toggled_key_list (view);
+	update_level (view); // Esto actualizará view->level y programará update_view
 }
 
 int
 tecla_view_get_num_levels (TeclaView *view)
 {
+	guint roles = 0, i;
+
     // Esta lógica depende de si las teclas Shift y AltGr están presentes en el layout actual.
     // Es posible que el modelo aún no se haya cargado o no tenga estas teclas.
     if (!view->model) return 1;
@@ -573,15 +972,141 @@ tecla_view_get_num_levels (TeclaView *view)
     // Para ser más robusto, deberíamos basarnos en las capacidades del xkb_keymap.
     // Pero la lógica actual de Tecla usa la presencia de teclas especiales en el pc105_layout.
     // Para este cambio, mantenemos la lógica existente pero asegurándonos que
-    // level2_keys y level3_keys se pueblan correctamente en update_from_model_foreach
+    // los roles de las teclas se calculan correctamente en update_key
     // incluso si no son parte del layout visual (ej. si el layout es muy minimalista).
 
-	if (view->level2_keys && view->level3_keys) // Tiene Shift y AltGr
+	for (i = 0; i < view->key_names->len; i++)
+		roles |= view->key_roles[i];
+
+	if (roles == (LEVEL2_PRESSED | LEVEL3_PRESSED)) // Tiene Shift y AltGr
 		return 4;
-	else if (view->level3_keys) // Tiene solo AltGr (o AltGr y no Shift, raro pero posible)
+	else if (roles == LEVEL3_PRESSED) // Tiene solo AltGr (o AltGr y no Shift, raro pero posible)
 		return 2; // Asumimos Base y AltGr
-    else if (view->level2_keys) // Tiene solo Shift
+    else if (roles == LEVEL2_PRESSED) // Tiene solo Shift
         return 2; // Asumimos Base y Shift
 	else // No tiene ni Shift ni AltGr detectados como modificadores de nivel
 		return 1;
 }
+
+TeclaModel *
+tecla_view_get_model (TeclaView *view)
+{
+	return view->model;
+}
+
+void
+tecla_view_set_highlighted_key (TeclaView     *view,
+				xkb_keycode_t  keycode)
+{
+	guint slot;
+
+	slot = keycode == XKB_KEYCODE_INVALID ? 0 : get_key_slot (view, keycode);
+
+	if (view->highlighted_slot == slot)
+		return;
+
+	if (view->highlighted_slot != 0)
+		set_key_highlighted (view, view->highlighted_slot - 1, FALSE);
+
+	view->highlighted_slot = slot;
+
+	if (view->highlighted_slot != 0)
+		set_key_highlighted (view, view->highlighted_slot - 1, TRUE);
+}
+
+void
+tecla_view_handle_key_event (TeclaView *view,
+			     guint      keycode,
+			     gboolean   pressed)
+{
+	GtkWidget *key = NULL;
+	const gchar *name;
+	guint slot;
+
+	if (!view->model)
+		return;
+
+	slot = get_key_slot (view, keycode);
+	if (slot != 0)
+		key = get_key_widget (view, slot - 1);
+
+	if (pressed) {
+		if (!key)
+			return;
+
+		set_key_state (view, slot - 1, GTK_STATE_FLAG_ACTIVE, TRUE);
+		update_toggled_keys (view, view->key_roles[slot - 1]);
+		update_level (view);
+	} else {
+		if (key) {
+			set_key_state (view, slot - 1, GTK_STATE_FLAG_ACTIVE, FALSE);
+			name = g_ptr_array_index (view->key_names, slot - 1);
+		} else {
+			name = tecla_model_get_keycode_key (view->model, keycode);
+		}
+
+		g_signal_emit (view, signals[KEY_ACTIVATED], 0, name, key);
+	}
+}
+
+gboolean
+tecla_view_get_single_widget (TeclaView *view)
+{
+	return view->single_widget;
+}
+
+void
+tecla_view_set_single_widget (TeclaView *view,
+			      gboolean   single_widget)
+{
+	single_widget = !!single_widget;
+	if (view->single_widget == single_widget)
+		return;
+
+	view->single_widget = single_widget;
+
+	/* Rebuild the keys if already constructed */
+	if (view->key_roles) {
+		construct_keys (view);
+		queue_update (view, NULL);
+		update_toggled_key_list (view);
+
+		if (view->highlighted_slot != 0)
+			set_key_highlighted (view, view->highlighted_slot - 1, TRUE);
+	}
+
+	g_object_notify_by_pspec (G_OBJECT (view), props[PROP_SINGLE_WIDGET]);
+}
+
+gboolean
+tecla_view_get_key_bounds (TeclaView       *view,
+			   const gchar     *name,
+			   graphene_rect_t *bounds)
+{
+	guint slot;
+
+	if (!view->canvas)
+		return FALSE;
+
+	slot = GPOINTER_TO_UINT (g_hash_table_lookup (view->slots_by_name, name));
+	if (slot == 0)
+		return FALSE;
+
+	return tecla_canvas_get_key_bounds (TECLA_CANVAS (view->canvas),
+					    slot - 1, bounds);
+}
+
+/* Shows @name pressed, on its own slot in single-widget mode too */
+void
+tecla_view_set_key_active (TeclaView   *view,
+			   const gchar *name,
+			   gboolean     active)
+{
+	guint slot;
+
+	slot = GPOINTER_TO_UINT (g_hash_table_lookup (view->slots_by_name, name));
+	if (slot == 0)
+		return;
+
+	set_key_state (view, slot - 1, GTK_STATE_FLAG_ACTIVE, active);
+}
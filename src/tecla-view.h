@@ -34,9 +34,32 @@ GtkWidget * tecla_view_new (void);
 void tecla_view_set_model (TeclaView  *view,
 			   TeclaModel *model);
 
+TeclaModel * tecla_view_get_model (TeclaView *view);
+
+int tecla_view_get_group (TeclaView *view);
+
+void tecla_view_set_group (TeclaView *view,
+			   int        group);
+
 int tecla_view_get_current_level (TeclaView *view);
 
 void tecla_view_set_current_level (TeclaView *view,
 				   int        level);
 
 int tecla_view_get_num_levels (TeclaView *view);
+
+void tecla_view_set_highlighted_key (TeclaView     *view,
+				     xkb_keycode_t  keycode);
+
+gboolean tecla_view_get_single_widget (TeclaView *view);
+
+void tecla_view_set_single_widget (TeclaView *view,
+				   gboolean   single_widget);
+
+gboolean tecla_view_get_key_bounds (TeclaView       *view,
+				    const gchar     *name,
+				    graphene_rect_t *bounds);
+
+void tecla_view_set_key_active (TeclaView   *view,
+				const gchar *name,
+				gboolean     active);